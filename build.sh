@@ -3,10 +3,13 @@
 CXXFLAGS="-O2"
 
 if [[ "$1" == "-g" ]]; then
-    CXXFLAGS="-g -O0 -fsanitize=address,undefined"
+    CXXFLAGS="-g -O0 -fsanitize=address,undefined -DIMAGE_BOUNDS_CHECK"
+elif [[ "$1" == "-p" ]]; then
+    CXXFLAGS="-O2 -DMATCH_PROFILE"
 fi
 
 set -e
 set -x
 
-g++ src/main.cpp -o template-matching -std=c++17 $CXXFLAGS -Wall -Wextra
+g++ src/main.cpp -o template-matching -std=c++17 $CXXFLAGS -Wall -Wextra -pthread
+g++ src/benchmark.cpp -o benchmark -std=c++17 $CXXFLAGS -Wall -Wextra -pthread
@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "image_io.cpp"
+#include "match.cpp"
+#include "match_accelerated.cpp"
+#include "match_orient.cpp"
+#include "match_scale.cpp"
+
+// Benchmark of the four public matchers over every test-data case. Each (matcher, case) pair is run once cold and
+// then `reps` times warm; the warm latencies give min/median/p99, and the FFT count and peak RSS are sampled around
+// them. Results go to a JSON file that can serve as the baseline of a later run; timings are also recorded relative
+// to a fixed calibration workload so that a baseline taken on another machine can still be compared.
+
+struct Matcher {
+    const char *name;
+    std::function<void(const Image &, const Image &, int &, int &)> run;
+};
+
+struct TestCase {
+    std::string name;
+    Image image, templateImage;
+};
+
+struct CaseResult {
+    std::string matcher, name;
+    int x, y;
+    double coldMs, minMs, medianMs, p99Ms, meanMs;
+    double fftPerCall, probesPerCall;
+    long peakRssKb;
+};
+
+struct MatcherSummary {
+    std::string matcher;
+    // 各用例中位数之和，即整套用例跑一遍的典型耗时
+    double totalMedianMs;
+    double throughput;
+    long peakRssKb;
+};
+
+struct Baseline {
+    int threads = 0;
+    // 0 表示基准文件中没有校准耗时
+    double calibrationMs = 0;
+    std::vector<CaseResult> results;
+    std::vector<MatcherSummary> summaries;
+};
+
+// 匹配方法会向 stderr 输出每次的得分，计时期间将其重定向到 /dev/null
+class StderrSilencer {
+  public:
+    StderrSilencer() {
+        fflush(stderr);
+        saved = dup(STDERR_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+
+    ~StderrSilencer() {
+        fflush(stderr);
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+    }
+
+  private:
+    int saved;
+};
+
+// 进程的峰值常驻内存（KB）
+long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// 已排序样本的最近秩分位数
+double percentile(const std::vector<double> &sorted, double q) {
+    int rank = static_cast<int>(std::ceil(q * sorted.size())) - 1;
+    return sorted[std::clamp(rank, 0, static_cast<int>(sorted.size()) - 1)];
+}
+
+// A fixed single-threaded workload that does not use any code of the matchers: a direct cross-correlation of a
+// 32x32 template over a 128x128 image of pseudo-random pixels. Its fastest time out of `runs` measures the speed of
+// the machine, and matcher timings divided by it can be compared across machines.
+double calibrationMs(int runs = 7) {
+    using Clock = std::chrono::steady_clock;
+    const int N = 128, M = 32;
+    std::vector<float> image(N * N), templ(M * M);
+    unsigned seed = 1;
+    for (float &v : image) {
+        seed = seed * 1103515245 + 12345;
+        v = static_cast<float>(seed >> 24);
+    }
+    for (int i = 0; i < M; i++) {
+        std::copy_n(&image[(i + 40) * N + 40], M, &templ[i * M]);
+    }
+    double best = INFINITY;
+    volatile float sink = 0;
+    for (int run = 0; run < runs; run++) {
+        auto start = Clock::now();
+        float bestScore = 0;
+        for (int x = 0; x + M <= N; x++) {
+            for (int y = 0; y + M <= N; y++) {
+                float score = 0;
+                for (int i = 0; i < M; i++) {
+                    for (int j = 0; j < M; j++) {
+                        score += image[(x + i) * N + y + j] * templ[i * M + j];
+                    }
+                }
+                bestScore = std::max(bestScore, score);
+            }
+        }
+        sink = sink + bestScore;
+        best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+std::vector<TestCase> loadCases(const std::string &dataFolder) {
+    std::vector<std::filesystem::path> folders;
+    for (const auto &entry : std::filesystem::directory_iterator(dataFolder)) {
+        if (entry.is_directory()) {
+            folders.push_back(entry.path());
+        }
+    }
+    std::sort(folders.begin(), folders.end());
+    std::vector<TestCase> cases;
+    for (const auto &folder : folders) {
+        TestCase testCase;
+        testCase.name = folder.filename().string();
+        if (ImageIO::loadImage(ImageIO::findImageFile(folder.string(), "image"), testCase.image) &&
+            ImageIO::loadImage(ImageIO::findImageFile(folder.string(), "template"), testCase.templateImage)) {
+            cases.push_back(std::move(testCase));
+        } else {
+            fprintf(stderr, "Skipping %s: cannot read image or template\n", folder.string().c_str());
+        }
+    }
+    return cases;
+}
+
+CaseResult runCase(const Matcher &matcher, const TestCase &testCase, int reps) {
+    using Clock = std::chrono::steady_clock;
+    auto elapsedMs = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+    CaseResult result{matcher.name, testCase.name, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+    StderrSilencer silencer;
+    // 第一次调用包含模板缓存与FFT计划的构建
+    auto start = Clock::now();
+    matcher.run(testCase.image, testCase.templateImage, result.x, result.y);
+    result.coldMs = elapsedMs(start);
+
+    std::vector<double> latencies(reps);
+    const int64 fftBefore = Utils::Fft2D::transformCount().load();
+    const int64 probesBefore = refineProbeCount().load();
+    for (int i = 0; i < reps; i++) {
+        int x = -1, y = -1;
+        start = Clock::now();
+        matcher.run(testCase.image, testCase.templateImage, x, y);
+        latencies[i] = elapsedMs(start);
+    }
+    result.fftPerCall = static_cast<double>(Utils::Fft2D::transformCount().load() - fftBefore) / reps;
+    result.probesPerCall = static_cast<double>(refineProbeCount().load() - probesBefore) / reps;
+    std::sort(latencies.begin(), latencies.end());
+    result.minMs = latencies.front();
+    result.medianMs = percentile(latencies, 0.5);
+    result.p99Ms = percentile(latencies, 0.99);
+    for (double latency : latencies) {
+        result.meanMs += latency / reps;
+    }
+    result.peakRssKb = peakRssKb();
+    return result;
+}
+
+void writeJson(const std::string &path, int reps, double calibration, const std::vector<CaseResult> &results,
+               const std::vector<MatcherSummary> &summaries) {
+    std::ofstream fout(path);
+    // 每个结果占一行，readBaseline 按行读取
+    fout << "{\n";
+    fout << "  \"reps\": " << reps << ",\n";
+    fout << "  \"threads\": " << ThreadPool::global().workerNum() << ",\n";
+    fout << "  \"fft_kernel\": \"" << Utils::FftKernel::kernels().name << "\",\n";
+    char calibrationLine[64];
+    snprintf(calibrationLine, sizeof(calibrationLine), "  \"calibration_ms\": %.3f,\n", calibration);
+    fout << calibrationLine;
+    fout << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const CaseResult &r = results[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    {\"matcher\": \"%s\", \"case\": \"%s\", \"x\": %d, \"y\": %d, \"cold_ms\": %.3f, "
+                 "\"min_ms\": %.3f, \"median_ms\": %.3f, \"p99_ms\": %.3f, \"mean_ms\": %.3f, \"fft_per_call\": %.1f, "
+                 "\"probes_per_call\": %.1f, \"peak_rss_kb\": %ld}%s\n",
+                 r.matcher.c_str(), r.name.c_str(), r.x, r.y, r.coldMs, r.minMs, r.medianMs, r.p99Ms, r.meanMs,
+                 r.fftPerCall, r.probesPerCall, r.peakRssKb, i + 1 < results.size() ? "," : "");
+        fout << line;
+    }
+    fout << "  ],\n";
+    fout << "  \"summary\": [\n";
+    for (size_t i = 0; i < summaries.size(); i++) {
+        const MatcherSummary &s = summaries[i];
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "    {\"matcher\": \"%s\", \"total_median_ms\": %.3f, "
+                 "\"throughput_per_s\": %.2f, \"peak_rss_kb\": %ld}%s\n",
+                 s.matcher.c_str(), s.totalMedianMs, s.throughput, s.peakRssKb, i + 1 < summaries.size() ? "," : "");
+        fout << line;
+    }
+    fout << "  ]\n";
+    fout << "}\n";
+}
+
+// 从 writeJson 写出的一行中取出 key 的值，不存在时返回空串
+std::string jsonField(const std::string &line, const std::string &key) {
+    size_t pos = line.find("\"" + key + "\": ");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += key.size() + 4;
+    if (line[pos] == '"') {
+        return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+    }
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+// 读取 writeJson 写出的基准文件
+bool readBaseline(const std::string &path, Baseline &baseline) {
+    std::ifstream fin(path);
+    if (!fin) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(fin, line)) {
+        if (!jsonField(line, "threads").empty()) {
+            baseline.threads = std::stoi(jsonField(line, "threads"));
+        } else if (!jsonField(line, "calibration_ms").empty()) {
+            baseline.calibrationMs = std::stod(jsonField(line, "calibration_ms"));
+        } else if (!jsonField(line, "case").empty()) {
+            CaseResult r{};
+            r.matcher = jsonField(line, "matcher");
+            r.name = jsonField(line, "case");
+            r.x = std::stoi(jsonField(line, "x"));
+            r.y = std::stoi(jsonField(line, "y"));
+            r.minMs = std::stod(jsonField(line, "min_ms"));
+            r.medianMs = std::stod(jsonField(line, "median_ms"));
+            baseline.results.push_back(r);
+        } else if (!jsonField(line, "total_median_ms").empty()) {
+            MatcherSummary s{};
+            s.matcher = jsonField(line, "matcher");
+            s.totalMedianMs = std::stod(jsonField(line, "total_median_ms"));
+            baseline.summaries.push_back(s);
+        }
+    }
+    return true;
+}
+
+// A case regresses only if its position changed: the latency of a single case is too noisy to gate on. Timing is
+// gated per matcher on the summed medians, each divided by the calibration time of its run so that a baseline from
+// another machine stays meaningful. A matcher regresses if this ratio grew by more than `tolerance` (a fraction)
+// and by more than NOISE_FLOOR calibration times: back-to-back runs on a shared machine differ in the total of a
+// short matcher by more than one calibration time. Timings are not compared when the baseline has no calibration or
+// was taken with a different thread count. Returns the number of regressions.
+int compareWithBaseline(const std::vector<CaseResult> &results, const std::vector<MatcherSummary> &summaries,
+                        double calibration, const Baseline &baseline, double tolerance) {
+    const double NOISE_FLOOR = 2.0;
+    int regressions = 0;
+    for (const CaseResult &r : results) {
+        auto base = std::find_if(baseline.results.begin(), baseline.results.end(), [&](const CaseResult &b) {
+            return b.matcher == r.matcher && b.name == r.name;
+        });
+        if (base == baseline.results.end()) {
+            printf("NEW        %-18s %-12s\n", r.matcher.c_str(), r.name.c_str());
+        } else if (base->x != r.x || base->y != r.y) {
+            printf("REGRESSION %-18s %-12s position (%d, %d) -> (%d, %d)\n", r.matcher.c_str(), r.name.c_str(),
+                   base->x, base->y, r.x, r.y);
+            regressions++;
+        }
+    }
+    const int threads = ThreadPool::global().workerNum();
+    if (baseline.calibrationMs <= 0 || baseline.threads != threads) {
+        printf("Timings not compared: the baseline %s\n",
+               baseline.calibrationMs <= 0 ? "has no calibration" : "was taken with a different thread count");
+        return regressions;
+    }
+    // 基准耗时换算到当前机器的速度
+    const double speed = calibration / baseline.calibrationMs;
+    for (const MatcherSummary &s : summaries) {
+        for (const MatcherSummary &base : baseline.summaries) {
+            if (base.matcher != s.matcher) {
+                continue;
+            }
+            const double expected = base.totalMedianMs * speed;
+            bool regressed =
+                s.totalMedianMs > expected * (1 + tolerance) && s.totalMedianMs - expected > NOISE_FLOOR * calibration;
+            printf("%-10s %-18s total %.3fms -> %.3fms (%+.1f%%)\n", regressed ? "REGRESSION" : "OK", s.matcher.c_str(),
+                   expected, s.totalMedianMs, (s.totalMedianMs / expected - 1) * 100);
+            regressions += regressed;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    int reps = 10;
+    double tolerance = 0.4;
+    std::string dataFolder = "test-data", jsonPath = "benchmark.json", baselinePath, only;
+    bool usageError = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-n" && i + 1 < argc) {
+            reps = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "-j" && i + 1 < argc) {
+            ThreadPool::setGlobalWorkerNum(std::atoi(argv[++i]));
+        } else if (arg == "--data" && i + 1 < argc) {
+            dataFolder = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = std::atof(argv[++i]);
+        } else if (arg == "--matcher" && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            usageError = true;
+        }
+    }
+    if (usageError) {
+        printf("Usage: %s [-n <reps>] [-j <threads>] [--data <test-data-folder>] [--matcher <name>] "
+               "[--json <output>] [--baseline <json>] [--tolerance <fraction>]\n",
+               argv[0]);
+        return 0;
+    }
+
+    const std::vector<Matcher> matchers = {
+        {"match", [](const Image &s, const Image &t, int &x, int &y) { Match(s, t, x, y); }},
+        {"match_accelerated", [](const Image &s, const Image &t, int &x, int &y) { Match_accelerated(s, t, x, y); }},
+        {"match_orient", [](const Image &s, const Image &t, int &x, int &y) { Match_also_orient(s, t, x, y); }},
+        {"match_scale", [](const Image &s, const Image &t, int &x, int &y) { Match_also_scale(s, t, x, y); }},
+    };
+    std::vector<TestCase> cases = loadCases(dataFolder);
+    if (cases.empty()) {
+        fprintf(stderr, "No test cases found in %s\n", dataFolder.c_str());
+        return 1;
+    }
+
+    // 在所有方法之前与之后各校准一次取较快者，减小期间频率变化的影响
+    double calibration = calibrationMs();
+    std::vector<CaseResult> results;
+    std::vector<MatcherSummary> summaries;
+    printf("%-18s %-12s %4s %4s %9s %9s %9s %9s %7s %7s %9s\n", "matcher", "case", "x", "y", "cold_ms", "min_ms",
+           "median_ms", "p99_ms", "fft", "probes", "rss_kb");
+    for (const Matcher &matcher : matchers) {
+        if (!only.empty() && only != matcher.name) {
+            continue;
+        }
+        MatcherSummary summary{matcher.name, 0, 0, 0};
+        double totalMeanMs = 0;
+        for (const TestCase &testCase : cases) {
+            CaseResult r = runCase(matcher, testCase, reps);
+            printf("%-18s %-12s %4d %4d %9.3f %9.3f %9.3f %9.3f %7.1f %7.1f %9ld\n", r.matcher.c_str(),
+                   r.name.c_str(), r.x, r.y, r.coldMs, r.minMs, r.medianMs, r.p99Ms, r.fftPerCall, r.probesPerCall,
+                   r.peakRssKb);
+            summary.totalMedianMs += r.medianMs;
+            totalMeanMs += r.meanMs;
+            results.push_back(r);
+        }
+        summary.throughput = cases.size() * 1000.0 / totalMeanMs;
+        summary.peakRssKb = peakRssKb();
+        printf("%-18s total %.3fms, %.2f calls/s\n", matcher.name, summary.totalMedianMs, summary.throughput);
+        summaries.push_back(summary);
+    }
+    calibration = std::min(calibration, calibrationMs());
+    printf("calibration %.3fms\n", calibration);
+    writeJson(jsonPath, reps, calibration, results, summaries);
+
+    if (!baselinePath.empty()) {
+        Baseline baseline;
+        if (!readBaseline(baselinePath, baseline)) {
+            fprintf(stderr, "Cannot read baseline %s\n", baselinePath.c_str());
+            return 1;
+        }
+        int regressions = compareWithBaseline(results, summaries, calibration, baseline, tolerance);
+        if (regressions > 0) {
+            printf("%d regression(s) against %s\n", regressions, baselinePath.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -13,5 +13,9 @@ const double PI = acos(-1);
 const int S_SIZE = 256;
 const int T_SIZE = 64;
 const float DETECT_SENSITIVITY = 1.0;
+// 搜索使用的线程数，0 表示使用全部核心
+const int DEFAULT_WORKER_NUM = 0;
+// 金字塔搜索中粗搜索所在的层数，图像缩小 2^层数 倍
+const int DEFAULT_PYRAMID_LEVEL = 1;
 
 #endif
\ No newline at end of file
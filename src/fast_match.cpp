@@ -1,174 +1,401 @@
+#ifndef _FAST_MATCH_CPP
+#define _FAST_MATCH_CPP
+
 #include <algorithm>
 #include <climits>
 #include <cmath>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "constants.h"
+#include "fft.hpp"
 #include "image.hpp"
+#include "mask.hpp"
+#include "peak_heap.hpp"
+#include "profile.hpp"
+#include "score.hpp"
 
-namespace Utils {
+using Utils::fft;
 
-struct Complex {
-    double real, imag;
-    Complex() : Complex(0, 0) {}
-    Complex(double real_, double imag_) : real(real_), imag(imag_) {}
-    Complex operator+(const Complex &other) const { return Complex(real + other.real, imag + other.imag); }
-    Complex operator-(const Complex &other) const { return Complex(real - other.real, imag - other.imag); }
-    Complex operator*(const Complex &other) const {
-        return Complex(real * other.real - imag * other.imag, real * other.imag + imag * other.real);
-    }
-    Complex &operator+=(const Complex &other) {
-        real += other.real;
-        imag += other.imag;
-        return *this;
-    }
-    Complex &operator-=(const Complex &other) {
-        real -= other.real;
-        imag -= other.imag;
-        return *this;
-    }
-    Complex &operator*=(const Complex &other) {
-        double new_real = real * other.real - imag * other.imag;
-        double new_imag = real * other.imag + imag * other.real;
-        real = new_real;
-        imag = new_imag;
-        return *this;
-    }
-    Complex &operator/=(double other) {
-        real /= other;
-        imag /= other;
-        return *this;
-    }
+struct MatchResult {
+    double score;
+    int x, y;
 };
 
-void dft(std::vector<Complex> &a, const std::vector<int> &to, bool invert) {
-    int n = a.size();
+class PreparedTarget;
+class PreparedTemplate;
 
-    for (int i = 0; i < n; i++) {
-        if (i < to[i]) {
-            std::swap(a[i], a[to[i]]);
-        }
-    }
+// Calls onRow(x, scores, count) for every row x of the score surface, in order; scores[y] is the score under `mode`
+// of the template placed with its top-left corner at (x, y). Returns false without calling it if the template does
+// not fit.
+bool scanScores(const PreparedTarget &target, const PreparedTemplate &t, ScoreMode mode,
+                const std::function<void(int, const double *, int)> &onRow);
+
+// Target-side data of fastMatch, computed once and shared by every template probed against the same target.
+// A view passed in is kept by reference, so the pixels it shows must outlive the prepared target.
+class PreparedTarget {
+  public:
+    int height, width;
 
-    for (int len = 1; len < n; len <<= 1) {
-        double ang = PI / len * (invert ? -1 : 1);
-        Complex wlen(std::cos(ang), std::sin(ang));
-        for (int i = 0; i < n; i += 2 * len) {
-            Complex w(1, 0);
-            for (int j = 0; j < len; j++) {
-                Complex u = a[i + j];
-                Complex v = a[i + j + len] * w;
-                a[i + j] = u + v;
-                a[i + j + len] = u - v;
-                w *= wlen;
+    explicit PreparedTarget(const Image &s)
+        : PreparedTarget(s, Utils::nextFastSize(s.height), Utils::nextFastEvenSize(s.width)) {}
+
+    // Constructor with an explicit FFT size of at least the image size, so that targets of different sizes can share
+    // one template spectrum
+    PreparedTarget(const Image &s, int fftHeight, int fftWidth)
+        : height(s.height), width(s.width), plan(Utils::Fft2D::cached(fftHeight, fftWidth)), source(s),
+          specSRe(plan->spectrumSize()), specSIm(plan->spectrumSize()), integralS((s.height + 1) * (s.width + 1), 0),
+          integralS2((s.height + 1) * (s.width + 1), 0) {
+        std::vector<double> arrS(plan->height * plan->width, 0);
+        {
+            // 像素写入FFT输入数组，同时累加积分图
+            PROFILE_SCOPE(TargetPack);
+            for (int i = 0; i < height; i++) {
+                const uint8 *row = s.row(i);
+                double *dst = arrS.data() + i * plan->width;
+                for (int j = 0; j < width; j++) {
+                    dst[j] = row[j];
+                }
+                // 积分图按行累加：本行前缀和加上一行的积分
+                const int64 *above = integralS.data() + i * (width + 1);
+                int64 *current = integralS.data() + (i + 1) * (width + 1);
+                const int64 *above2 = integralS2.data() + i * (width + 1);
+                int64 *current2 = integralS2.data() + (i + 1) * (width + 1);
+                int64 rowSum = 0, rowSum2 = 0;
+                for (int j = 0; j < width; j++) {
+                    rowSum += row[j];
+                    rowSum2 += static_cast<int64>(row[j]) * row[j];
+                    current[j + 1] = above[j + 1] + rowSum;
+                    current2[j + 1] = above2[j + 1] + rowSum2;
+                }
             }
         }
+        plan->forwardReal(arrS.data(), specSRe.data(), specSIm.data());
     }
 
-    if (invert) {
-        for (Complex &x : a) {
-            x /= n;
-        }
-    }
-}
+    const Utils::Fft2D &fftPlan() const { return *plan; }
 
-std::vector<int64> fft(const std::vector<int64> &a, const std::vector<int64> &b) {
-    std::vector<Complex> fa;
-    int n = 1, k = 0;
-    while (n < int(a.size() + b.size())) {
-        n <<= 1;
-        k++;
-    }
-    fa.resize(n);
-    for (int i = 0; i < (int)a.size(); i++) {
-        fa[i].real = a[i];
-        fa[i].imag = b[i];
-    }
+    // Sum of s over the h x w window whose top-left corner is (x, y)
+    int64 windowSumS(int x, int y, int h, int w) const { return windowSum(integralS, x, y, h, w); }
+
+    // Sum of s^2 over the h x w window whose top-left corner is (x, y)
+    int64 windowSumS2(int x, int y, int h, int w) const { return windowSum(integralS2, x, y, h, w); }
 
-    std::vector<int> to(n);
-    for (int i = 0; i < n; i++) {
-        to[i] = (to[i >> 1] >> 1) | ((i & 1) << (k - 1));
+  private:
+    std::shared_ptr<const Utils::Fft2D> plan;
+    Image source;
+    std::vector<double> specSRe, specSIm;
+    // s^2 的频谱只有不规则掩码才需要，第一次用到时再计算
+    mutable std::once_flag specS2Once;
+    mutable std::vector<double> specS2Re, specS2Im;
+    std::vector<int64> integralS, integralS2;
+
+    int64 windowSum(const std::vector<int64> &integral, int x, int y, int h, int w) const {
+        const int stride = width + 1;
+        return integral[(x + h) * stride + y + w] - integral[x * stride + y + w] - integral[(x + h) * stride + y] +
+               integral[x * stride + y];
     }
 
-    dft(fa, to, false);
-    for (int i = 0; i < n; i++) {
-        fa[i] *= fa[i];
+    void prepareS2() const {
+        std::call_once(specS2Once, [this] {
+            std::vector<double> arrS2(plan->height * plan->width, 0);
+            for (int i = 0; i < height; i++) {
+                const uint8 *row = source.row(i);
+                double *dst = arrS2.data() + i * plan->width;
+                for (int j = 0; j < width; j++) {
+                    dst[j] = static_cast<int>(row[j]) * row[j];
+                }
+            }
+            specS2Re.resize(plan->spectrumSize());
+            specS2Im.resize(plan->spectrumSize());
+            plan->forwardReal(arrS2.data(), specS2Re.data(), specS2Im.data());
+        });
     }
-    dft(fa, to, true);
 
-    std::vector<int64> result(n);
-    for (int i = 0; i < n; i++) {
-        result[i] = std::round(fa[i].imag / 2);
+    friend bool scanScores(const PreparedTarget &target, const PreparedTemplate &t, ScoreMode mode,
+                           const std::function<void(int, const double *, int)> &onRow);
+};
+
+// Template-side data of fastMatch for one FFT size. It can be reused against every target of that size.
+class PreparedTemplate {
+  public:
+    int height, width;
+
+    PreparedTemplate(const Utils::Fft2D &plan, const Image &t, const Mask &tMask) { prepare(plan, t, &tMask); }
+
+    // Constructor for a template whose mask is the full rectangle
+    PreparedTemplate(const Utils::Fft2D &plan, const Image &t) { prepare(plan, t, nullptr); }
+
+    PreparedTemplate(const PreparedTarget &target, const Image &t, const Mask &tMask)
+        : PreparedTemplate(target.fftPlan(), t, tMask) {}
+
+    PreparedTemplate(const PreparedTarget &target, const Image &t) : PreparedTemplate(target.fftPlan(), t) {}
+
+    // Whether the spectra were computed at the FFT size the target uses
+    bool fits(const PreparedTarget &target) const {
+        return fftHeight == target.fftPlan().height && fftWidth == target.fftPlan().width;
     }
-    return result;
-}
 
-} // namespace Utils
+  private:
+    int fftHeight, fftWidth;
+    int64 sumT, sumT2, area;
+    bool fullMask;
+    std::vector<double> specTRe, specTIm, specMaskRe, specMaskIm;
 
-using Utils::fft;
+    // tMask 为空指针表示完整矩形
+    void prepare(const Utils::Fft2D &plan, const Image &t, const Mask *tMask) {
+        height = t.height;
+        width = t.width;
+        fftHeight = plan.height;
+        fftWidth = plan.width;
+        sumT = sumT2 = area = 0;
+        fullMask = tMask == nullptr || tMask->full();
+        const int F_WIDTH = plan.width;
+        std::vector<double> arrT(plan.height * F_WIDTH, 0);
+        std::vector<double> arrMask(fullMask ? 0 : plan.height * F_WIDTH, 0);
+        if (height <= plan.height && width <= plan.width) {
+            PROFILE_SCOPE(TemplatePack);
+            for (int i = 0; i < height; i++) {
+                const uint8 *row = t.row(i);
+                double *dstT = arrT.data() + i * F_WIDTH;
+                for (int j = 0; j < width; j++) {
+                    dstT[j] = row[j];
+                }
+                if (fullMask) {
+                    for (int j = 0; j < width; j++) {
+                        sumT += row[j];
+                        sumT2 += static_cast<int>(row[j]) * row[j];
+                    }
+                    area += width;
+                    continue;
+                }
+                const uint64 *maskWords = tMask->rowWords(i);
+                double *dstMask = arrMask.data() + i * F_WIDTH;
+                for (int j = 0; j < width; j++) {
+                    if ((maskWords[j >> 6] >> (j & 63)) & 1) {
+                        sumT += row[j];
+                        sumT2 += static_cast<int>(row[j]) * row[j];
+                        area++;
+                        dstMask[j] = 1;
+                    }
+                }
+            }
+        }
+        specTRe.resize(plan.spectrumSize());
+        specTIm.resize(plan.spectrumSize());
+        plan.forwardReal(arrT.data(), specTRe.data(), specTIm.data());
+        // 掩码为完整矩形时，窗口内 s^2 之和直接由积分图得到；否则需要掩码的频谱
+        if (!fullMask) {
+            specMaskRe.resize(plan.spectrumSize());
+            specMaskIm.resize(plan.spectrumSize());
+            plan.forwardReal(arrMask.data(), specMaskRe.data(), specMaskIm.data());
+        }
+    }
 
-struct MatchResult {
-    double score;
-    int x, y;
+    friend bool scanScores(const PreparedTarget &target, const PreparedTemplate &t, ScoreMode mode,
+                           const std::function<void(int, const double *, int)> &onRow);
 };
 
-MatchResult fastMatch(const Image &s, const Image &t, std::vector<std::vector<bool>> tMask) {
-    static int call_cnt = 0;
-    call_cnt++;
-    const int S_HEIGHT = s.height;
-    const int S_WIDTH = s.width;
+bool scanScores(const PreparedTarget &target, const PreparedTemplate &t, ScoreMode mode,
+                const std::function<void(int, const double *, int)> &onRow) {
+    PROFILE_SCOPE(ScoreScan);
+    const int S_HEIGHT = target.height;
+    const int S_WIDTH = target.width;
     const int T_HEIGHT = t.height;
     const int T_WIDTH = t.width;
     if (T_HEIGHT > S_HEIGHT || T_WIDTH > S_WIDTH) {
-        return {-std::numeric_limits<double>::infinity(), -1, -1};
+        return false;
     }
-    std::vector<int64> arrS(S_HEIGHT * S_WIDTH, 0);
-    std::vector<int64> arrT(S_HEIGHT * S_WIDTH, 0);
-    std::vector<int64> arrS2(S_HEIGHT * S_WIDTH, 0);
-    std::vector<int64> arrMask(S_HEIGHT * S_WIDTH, 0);
-    int64 sumT2 = 0;
-    for (int i = 0; i < S_HEIGHT; i++) {
-        for (int j = 0; j < S_WIDTH; j++) {
-            arrS[i * S_WIDTH + j] = s[i][j];
-            arrS2[i * S_WIDTH + j] = static_cast<int64>(s[i][j]) * s[i][j];
+    const Utils::Fft2D &plan = target.fftPlan();
+    const int F_WIDTH = plan.width;
+    const int specSize = plan.spectrumSize();
+    // 目标频谱（a）与模板一侧频谱（b）的互相关
+    auto correlate = [&](const std::vector<double> &aRe, const std::vector<double> &aIm, const std::vector<double> &bRe,
+                         const std::vector<double> &bIm) {
+        std::vector<double> re(specSize), im(specSize);
+        for (int i = 0; i < specSize; i++) {
+            double br = bRe[i], bi = bIm[i];
+            re[i] = aRe[i] * br + aIm[i] * bi;
+            im[i] = aIm[i] * br - aRe[i] * bi;
         }
+        std::vector<double> result(plan.height * F_WIDTH);
+        plan.inverseReal(re.data(), im.data(), result.data());
+        return result;
+    };
+    std::vector<double> stq = correlate(target.specSRe, target.specSIm, t.specTRe, t.specTIm);
+    // 不规则掩码下窗口内的 s^2 之和（以及 ZNCC 需要的 s 之和）由掩码的互相关得到，完整矩形时查积分图
+    const bool needS2 = mode != ScoreMode::CC;
+    const bool needS = mode == ScoreMode::ZNCC;
+    std::vector<double> s2q, s1q;
+    if (!t.fullMask && needS2) {
+        target.prepareS2();
+        s2q = correlate(target.specS2Re, target.specS2Im, t.specMaskRe, t.specMaskIm);
     }
-    for (int i = 0; i < T_HEIGHT; i++) {
-        for (int j = 0; j < T_WIDTH; j++) {
-            arrT[i * S_WIDTH + j] = t[i][j];
-            if (tMask[i][j]) {
-                sumT2 += static_cast<int64>(t[i][j]) * t[i][j];
-                arrMask[i * S_WIDTH + j] = 1;
-            }
-        }
+    if (!t.fullMask && needS) {
+        s1q = correlate(target.specSRe, target.specSIm, t.specMaskRe, t.specMaskIm);
     }
-    std::reverse(arrT.begin(), arrT.end());
-    std::reverse(arrMask.begin(), arrMask.end());
-    auto stq = fft(arrS, arrT);
-    auto s2q = fft(arrS2, arrMask);
     const int resHeight = S_HEIGHT - T_HEIGHT + 1;
     const int resWidth = S_WIDTH - T_WIDTH + 1;
-    std::vector result(resHeight, std::vector<double>(resWidth));
+    std::vector<double> scores(resWidth);
+    const uint64 t2 = t.sumT2;
+    const int64 t1 = t.sumT, n = t.area;
+    const double fullScale = static_cast<double>(n) * 255 * 255;
+    const double tVariance = static_cast<double>(n * t.sumT2 - t1 * t1);
     for (int bx = 0; bx < resHeight; bx++) {
-        for (int by = 0; by < resWidth; by++) {
-            uint64 s2 = s2q[bx * S_WIDTH + by + arrMask.size() - 1];
-            uint64 t2 = sumT2;
-            int64 st = stq[bx * S_WIDTH + by + arrT.size() - 1];
-            result[bx][by] = st / std::sqrt(static_cast<double>(s2 * t2));
+        const double *stRow = stq.data() + bx * F_WIDTH;
+        const double *s2Row = s2q.empty() ? nullptr : s2q.data() + bx * F_WIDTH;
+        const double *s1Row = s1q.empty() ? nullptr : s1q.data() + bx * F_WIDTH;
+        auto windowS2 = [&](int by) -> uint64 {
+            return t.fullMask ? target.windowSumS2(bx, by, T_HEIGHT, T_WIDTH) : std::llround(s2Row[by]);
+        };
+        switch (mode) {
+        case ScoreMode::SSD:
+            for (int by = 0; by < resWidth; by++) {
+                int64 ssd = static_cast<int64>(windowS2(by)) - 2 * std::llround(stRow[by]) + t.sumT2;
+                scores[by] = 1 - ssd / fullScale;
+            }
+            break;
+        case ScoreMode::CC:
+            for (int by = 0; by < resWidth; by++) {
+                scores[by] = std::llround(stRow[by]) / fullScale;
+            }
+            break;
+        case ScoreMode::NCC:
+            for (int by = 0; by < resWidth; by++) {
+                uint64 s2 = windowS2(by);
+                int64 st = std::llround(stRow[by]);
+                scores[by] = st / std::sqrt(static_cast<double>(s2) * static_cast<double>(t2));
+            }
+            break;
+        case ScoreMode::ZNCC:
+            for (int by = 0; by < resWidth; by++) {
+                int64 s1 = t.fullMask ? target.windowSumS(bx, by, T_HEIGHT, T_WIDTH) : std::llround(s1Row[by]);
+                int64 s2 = windowS2(by);
+                int64 st = std::llround(stRow[by]);
+                // 分子分母同乘 n，整数运算保证平坦窗口的方差恰为 0
+                double sVariance = static_cast<double>(n * s2 - s1 * s1);
+                scores[by] = sVariance > 0 && tVariance > 0 ? (n * st - s1 * t1) / std::sqrt(sVariance * tVariance) : 0;
+            }
+            break;
         }
+        PROFILE_SCOPE(PeakSelect);
+        onRow(bx, scores.data(), resWidth);
     }
+    return true;
+}
+
+MatchResult fastMatch(const PreparedTarget &target, const PreparedTemplate &t, ScoreMode mode = globalScoreMode()) {
+    // 逐行计算得分并在同一遍中取最大值，严格大于保证并列时取光栅序最先的位置
     double bestScore = -std::numeric_limits<double>::infinity();
     int retX = -1, retY = -1;
-    for (int bx = 0; bx < resHeight; bx++) {
-        for (int by = 0; by < resWidth; by++) {
-            double score = result[bx][by];
+    scanScores(target, t, mode, [&](int bx, const double *scores, int count) {
+        for (int by = 0; by < count; by++) {
+            double score = scores[by];
             if (score > bestScore) {
                 bestScore = score;
                 retX = bx;
                 retY = by;
             }
         }
-    }
+    });
     return {bestScore, retX, retY};
-}
\ No newline at end of file
+}
+
+// Up to k best-scoring placements at or above threshold, best first, no two of whose template rectangles overlap.
+// The surface is scanned once into a PeakHeap, so memory does not grow with the target. When that gives fewer
+// than k placements and the heap may have lost a peak, the surface is scanned again for placements clear of the
+// ones found, taken greedily by score; fewer than k are then returned only if every placement at or above
+// threshold overlaps one of them. The first result is always the one fastMatch returns, ties included.
+std::vector<MatchResult> fastMatchTopK(const PreparedTarget &target, const PreparedTemplate &t, int k,
+                                       double threshold = -std::numeric_limits<double>::infinity(),
+                                       ScoreMode mode = globalScoreMode()) {
+    const int h = t.height, w = t.width;
+    auto overlap = [h, w](const MatchResult &a, const MatchResult &b) {
+        return std::abs(a.x - b.x) < h && std::abs(a.y - b.y) < w;
+    };
+    auto peaks = makePeakHeap<MatchResult>(k, [](const MatchResult &peak) { return peak.score; }, overlap);
+    scanScores(target, t, mode, [&](int bx, const double *scores, int count) {
+        for (int by = 0; by < count; by++) {
+            // 取反的比较同时排除 NaN
+            if (!(scores[by] >= threshold) || !peaks.accepts(scores[by])) {
+                continue;
+            }
+            peaks.push({scores[by], bx, by});
+        }
+    });
+    std::vector<MatchResult> results = peaks.sorted();
+    if (static_cast<int>(results.size()) >= k || !peaks.mayHaveLost()) {
+        return results;
+    }
+    auto clear = [&](const MatchResult &peak) {
+        return std::none_of(results.begin(), results.end(), [&](const MatchResult &r) { return overlap(r, peak); });
+    };
+    std::vector<MatchResult> rest;
+    scanScores(target, t, mode, [&](int bx, const double *scores, int count) {
+        for (int by = 0; by < count; by++) {
+            if (scores[by] >= threshold && clear({scores[by], bx, by})) {
+                rest.push_back({scores[by], bx, by});
+            }
+        }
+    });
+    // 稳定排序保持光栅序，得分相同时先扫描到的优先
+    auto higher = [](const MatchResult &a, const MatchResult &b) { return a.score > b.score; };
+    std::stable_sort(rest.begin(), rest.end(), higher);
+    for (const MatchResult &peak : rest) {
+        if (static_cast<int>(results.size()) >= k) {
+            break;
+        }
+        if (clear(peak)) {
+            results.push_back(peak);
+        }
+    }
+    std::stable_sort(results.begin(), results.end(), higher);
+    return results;
+}
+
+MatchResult fastMatch(const PreparedTarget &target, const Image &t, const Mask &tMask,
+                      ScoreMode mode = globalScoreMode()) {
+    if (t.height > target.height || t.width > target.width) {
+        return {-std::numeric_limits<double>::infinity(), -1, -1};
+    }
+    return fastMatch(target, PreparedTemplate(target, t, tMask), mode);
+}
+
+// 模板掩码为完整矩形
+MatchResult fastMatch(const PreparedTarget &target, const Image &t, ScoreMode mode = globalScoreMode()) {
+    if (t.height > target.height || t.width > target.width) {
+        return {-std::numeric_limits<double>::infinity(), -1, -1};
+    }
+    return fastMatch(target, PreparedTemplate(target, t), mode);
+}
+
+MatchResult fastMatch(const Image &s, const Image &t, const Mask &tMask, ScoreMode mode = globalScoreMode()) {
+    return fastMatch(PreparedTarget(s), t, tMask, mode);
+}
+
+MatchResult fastMatch(const Image &s, const Image &t, ScoreMode mode = globalScoreMode()) {
+    return fastMatch(PreparedTarget(s), t, mode);
+}
+
+std::vector<MatchResult> fastMatchTopK(const PreparedTarget &target, const Image &t, int k,
+                                       double threshold = -std::numeric_limits<double>::infinity(),
+                                       ScoreMode mode = globalScoreMode()) {
+    if (t.height > target.height || t.width > target.width) {
+        return {};
+    }
+    return fastMatchTopK(target, PreparedTemplate(target, t), k, threshold, mode);
+}
+
+std::vector<MatchResult> fastMatchTopK(const PreparedTarget &target, const Image &t, const Mask &tMask, int k,
+                                       double threshold = -std::numeric_limits<double>::infinity(),
+                                       ScoreMode mode = globalScoreMode()) {
+    if (t.height > target.height || t.width > target.width) {
+        return {};
+    }
+    return fastMatchTopK(target, PreparedTemplate(target, t, tMask), k, threshold, mode);
+}
+
+#endif
@@ -0,0 +1,728 @@
+#ifndef _FFT_HPP
+#define _FFT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_X86
+#endif
+
+#include "constants.h"
+#include "profile.hpp"
+
+namespace Utils {
+
+// Radix-2 butterflies on split (SoA) storage: (a, b) <- (a + w * b, a - w * b) for `count` consecutive elements.
+// `butterfly` takes one twiddle per element, `butterflyUniform` one twiddle for the whole run.
+namespace FftKernel {
+
+inline void butterflyScalar(double *ar, double *ai, double *br, double *bi, const double *wr, const double *wi,
+                            int count) {
+    for (int j = 0; j < count; j++) {
+        double tr = br[j] * wr[j] - bi[j] * wi[j];
+        double ti = br[j] * wi[j] + bi[j] * wr[j];
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+    }
+}
+
+inline void butterflyUniformScalar(double *ar, double *ai, double *br, double *bi, double wr, double wi, int count) {
+    for (int j = 0; j < count; j++) {
+        double tr = br[j] * wr - bi[j] * wi;
+        double ti = br[j] * wi + bi[j] * wr;
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+    }
+}
+
+#ifdef FFT_X86
+
+inline void butterflySse2(double *ar, double *ai, double *br, double *bi, const double *wr, const double *wi,
+                          int count) {
+    int j = 0;
+    for (; j + 2 <= count; j += 2) {
+        __m128d vr = _mm_loadu_pd(br + j), vi = _mm_loadu_pd(bi + j);
+        __m128d cr = _mm_loadu_pd(wr + j), ci = _mm_loadu_pd(wi + j);
+        __m128d tr = _mm_sub_pd(_mm_mul_pd(vr, cr), _mm_mul_pd(vi, ci));
+        __m128d ti = _mm_add_pd(_mm_mul_pd(vr, ci), _mm_mul_pd(vi, cr));
+        __m128d ur = _mm_loadu_pd(ar + j), ui = _mm_loadu_pd(ai + j);
+        _mm_storeu_pd(br + j, _mm_sub_pd(ur, tr));
+        _mm_storeu_pd(bi + j, _mm_sub_pd(ui, ti));
+        _mm_storeu_pd(ar + j, _mm_add_pd(ur, tr));
+        _mm_storeu_pd(ai + j, _mm_add_pd(ui, ti));
+    }
+    butterflyScalar(ar + j, ai + j, br + j, bi + j, wr + j, wi + j, count - j);
+}
+
+inline void butterflyUniformSse2(double *ar, double *ai, double *br, double *bi, double wr, double wi, int count) {
+    const __m128d cr = _mm_set1_pd(wr), ci = _mm_set1_pd(wi);
+    int j = 0;
+    for (; j + 2 <= count; j += 2) {
+        __m128d vr = _mm_loadu_pd(br + j), vi = _mm_loadu_pd(bi + j);
+        __m128d tr = _mm_sub_pd(_mm_mul_pd(vr, cr), _mm_mul_pd(vi, ci));
+        __m128d ti = _mm_add_pd(_mm_mul_pd(vr, ci), _mm_mul_pd(vi, cr));
+        __m128d ur = _mm_loadu_pd(ar + j), ui = _mm_loadu_pd(ai + j);
+        _mm_storeu_pd(br + j, _mm_sub_pd(ur, tr));
+        _mm_storeu_pd(bi + j, _mm_sub_pd(ui, ti));
+        _mm_storeu_pd(ar + j, _mm_add_pd(ur, tr));
+        _mm_storeu_pd(ai + j, _mm_add_pd(ui, ti));
+    }
+    butterflyUniformScalar(ar + j, ai + j, br + j, bi + j, wr, wi, count - j);
+}
+
+__attribute__((target("avx2,fma"))) inline void butterflyAvx2(double *ar, double *ai, double *br, double *bi,
+                                                              const double *wr, const double *wi, int count) {
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d vr = _mm256_loadu_pd(br + j), vi = _mm256_loadu_pd(bi + j);
+        __m256d cr = _mm256_loadu_pd(wr + j), ci = _mm256_loadu_pd(wi + j);
+        __m256d tr = _mm256_fmsub_pd(vr, cr, _mm256_mul_pd(vi, ci));
+        __m256d ti = _mm256_fmadd_pd(vr, ci, _mm256_mul_pd(vi, cr));
+        __m256d ur = _mm256_loadu_pd(ar + j), ui = _mm256_loadu_pd(ai + j);
+        _mm256_storeu_pd(br + j, _mm256_sub_pd(ur, tr));
+        _mm256_storeu_pd(bi + j, _mm256_sub_pd(ui, ti));
+        _mm256_storeu_pd(ar + j, _mm256_add_pd(ur, tr));
+        _mm256_storeu_pd(ai + j, _mm256_add_pd(ui, ti));
+    }
+    butterflyScalar(ar + j, ai + j, br + j, bi + j, wr + j, wi + j, count - j);
+}
+
+__attribute__((target("avx2,fma"))) inline void butterflyUniformAvx2(double *ar, double *ai, double *br, double *bi,
+                                                                     double wr, double wi, int count) {
+    const __m256d cr = _mm256_set1_pd(wr), ci = _mm256_set1_pd(wi);
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d vr = _mm256_loadu_pd(br + j), vi = _mm256_loadu_pd(bi + j);
+        __m256d tr = _mm256_fmsub_pd(vr, cr, _mm256_mul_pd(vi, ci));
+        __m256d ti = _mm256_fmadd_pd(vr, ci, _mm256_mul_pd(vi, cr));
+        __m256d ur = _mm256_loadu_pd(ar + j), ui = _mm256_loadu_pd(ai + j);
+        _mm256_storeu_pd(br + j, _mm256_sub_pd(ur, tr));
+        _mm256_storeu_pd(bi + j, _mm256_sub_pd(ui, ti));
+        _mm256_storeu_pd(ar + j, _mm256_add_pd(ur, tr));
+        _mm256_storeu_pd(ai + j, _mm256_add_pd(ui, ti));
+    }
+    butterflyUniformScalar(ar + j, ai + j, br + j, bi + j, wr, wi, count - j);
+}
+
+#endif
+
+// Radix-3 and radix-5 butterflies of the mixed-radix transform: out[k] = w[k] * sum_r in[r] * exp(-2pi i r k / P)
+// for `count` consecutive elements, with w[0] = 1 and w[k] = (wr[k-1], wi[k-1]).
+const double SIN_PI_3 = 0.86602540378443864676;
+const double COS_2PI_5 = 0.30901699437494742410, COS_4PI_5 = -0.80901699437494742410;
+const double SIN_2PI_5 = 0.95105651629515357212, SIN_4PI_5 = 0.58778525229247312917;
+
+inline void butterfly3Range(const double *const *inRe, const double *const *inIm, double *const *outRe,
+                            double *const *outIm, const double *wr, const double *wi, int begin, int end) {
+    for (int j = begin; j < end; j++) {
+        double sr = inRe[1][j] + inRe[2][j], si = inIm[1][j] + inIm[2][j];
+        double dr = SIN_PI_3 * (inRe[1][j] - inRe[2][j]), di = SIN_PI_3 * (inIm[1][j] - inIm[2][j]);
+        double tr = inRe[0][j] - 0.5 * sr, ti = inIm[0][j] - 0.5 * si;
+        outRe[0][j] = inRe[0][j] + sr;
+        outIm[0][j] = inIm[0][j] + si;
+        // y1 = t - i d，y2 = t + i d
+        double y1r = tr + di, y1i = ti - dr, y2r = tr - di, y2i = ti + dr;
+        outRe[1][j] = y1r * wr[0] - y1i * wi[0];
+        outIm[1][j] = y1r * wi[0] + y1i * wr[0];
+        outRe[2][j] = y2r * wr[1] - y2i * wi[1];
+        outIm[2][j] = y2r * wi[1] + y2i * wr[1];
+    }
+}
+
+inline void butterfly5Range(const double *const *inRe, const double *const *inIm, double *const *outRe,
+                            double *const *outIm, const double *wr, const double *wi, int begin, int end) {
+    for (int j = begin; j < end; j++) {
+        double b1r = inRe[1][j] + inRe[4][j], b1i = inIm[1][j] + inIm[4][j];
+        double b2r = inRe[2][j] + inRe[3][j], b2i = inIm[2][j] + inIm[3][j];
+        double d1r = inRe[1][j] - inRe[4][j], d1i = inIm[1][j] - inIm[4][j];
+        double d2r = inRe[2][j] - inRe[3][j], d2i = inIm[2][j] - inIm[3][j];
+        double ar = inRe[0][j], ai = inIm[0][j];
+        outRe[0][j] = ar + b1r + b2r;
+        outIm[0][j] = ai + b1i + b2i;
+        double t1r = ar + COS_2PI_5 * b1r + COS_4PI_5 * b2r, t1i = ai + COS_2PI_5 * b1i + COS_4PI_5 * b2i;
+        double t2r = ar + COS_4PI_5 * b1r + COS_2PI_5 * b2r, t2i = ai + COS_4PI_5 * b1i + COS_2PI_5 * b2i;
+        double u1r = SIN_2PI_5 * d1r + SIN_4PI_5 * d2r, u1i = SIN_2PI_5 * d1i + SIN_4PI_5 * d2i;
+        double u2r = SIN_4PI_5 * d1r - SIN_2PI_5 * d2r, u2i = SIN_4PI_5 * d1i - SIN_2PI_5 * d2i;
+        // y1 = t1 - i u1，y2 = t2 - i u2，y3 = t2 + i u2，y4 = t1 + i u1
+        double yr[4] = {t1r + u1i, t2r + u2i, t2r - u2i, t1r - u1i};
+        double yi[4] = {t1i - u1r, t2i - u2r, t2i + u2r, t1i + u1r};
+        for (int k = 0; k < 4; k++) {
+            outRe[k + 1][j] = yr[k] * wr[k] - yi[k] * wi[k];
+            outIm[k + 1][j] = yr[k] * wi[k] + yi[k] * wr[k];
+        }
+    }
+}
+
+inline void butterfly3Scalar(const double *const *inRe, const double *const *inIm, double *const *outRe,
+                             double *const *outIm, const double *wr, const double *wi, int count) {
+    butterfly3Range(inRe, inIm, outRe, outIm, wr, wi, 0, count);
+}
+
+inline void butterfly5Scalar(const double *const *inRe, const double *const *inIm, double *const *outRe,
+                             double *const *outIm, const double *wr, const double *wi, int count) {
+    butterfly5Range(inRe, inIm, outRe, outIm, wr, wi, 0, count);
+}
+
+#ifdef FFT_X86
+
+// (xr + i xi) * (wr + i wi)
+__attribute__((target("avx2,fma"))) inline void storeTwiddledAvx2(double *outRe, double *outIm, __m256d xr,
+                                                                  __m256d xi, __m256d wr, __m256d wi) {
+    _mm256_storeu_pd(outRe, _mm256_fmsub_pd(xr, wr, _mm256_mul_pd(xi, wi)));
+    _mm256_storeu_pd(outIm, _mm256_fmadd_pd(xr, wi, _mm256_mul_pd(xi, wr)));
+}
+
+__attribute__((target("avx2,fma"))) inline void butterfly3Avx2(const double *const *inRe, const double *const *inIm,
+                                                               double *const *outRe, double *const *outIm,
+                                                               const double *wr, const double *wi, int count) {
+    const __m256d sin3 = _mm256_set1_pd(SIN_PI_3), half = _mm256_set1_pd(0.5);
+    const __m256d w1r = _mm256_set1_pd(wr[0]), w1i = _mm256_set1_pd(wi[0]);
+    const __m256d w2r = _mm256_set1_pd(wr[1]), w2i = _mm256_set1_pd(wi[1]);
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d a0r = _mm256_loadu_pd(inRe[0] + j), a0i = _mm256_loadu_pd(inIm[0] + j);
+        __m256d a1r = _mm256_loadu_pd(inRe[1] + j), a1i = _mm256_loadu_pd(inIm[1] + j);
+        __m256d a2r = _mm256_loadu_pd(inRe[2] + j), a2i = _mm256_loadu_pd(inIm[2] + j);
+        __m256d sr = _mm256_add_pd(a1r, a2r), si = _mm256_add_pd(a1i, a2i);
+        __m256d dr = _mm256_mul_pd(sin3, _mm256_sub_pd(a1r, a2r)), di = _mm256_mul_pd(sin3, _mm256_sub_pd(a1i, a2i));
+        __m256d tr = _mm256_fnmadd_pd(half, sr, a0r), ti = _mm256_fnmadd_pd(half, si, a0i);
+        _mm256_storeu_pd(outRe[0] + j, _mm256_add_pd(a0r, sr));
+        _mm256_storeu_pd(outIm[0] + j, _mm256_add_pd(a0i, si));
+        storeTwiddledAvx2(outRe[1] + j, outIm[1] + j, _mm256_add_pd(tr, di), _mm256_sub_pd(ti, dr), w1r, w1i);
+        storeTwiddledAvx2(outRe[2] + j, outIm[2] + j, _mm256_sub_pd(tr, di), _mm256_add_pd(ti, dr), w2r, w2i);
+    }
+    butterfly3Range(inRe, inIm, outRe, outIm, wr, wi, j, count);
+}
+
+__attribute__((target("avx2,fma"))) inline void butterfly5Avx2(const double *const *inRe, const double *const *inIm,
+                                                               double *const *outRe, double *const *outIm,
+                                                               const double *wr, const double *wi, int count) {
+    const __m256d c1 = _mm256_set1_pd(COS_2PI_5), c2 = _mm256_set1_pd(COS_4PI_5);
+    const __m256d s1 = _mm256_set1_pd(SIN_2PI_5), s2 = _mm256_set1_pd(SIN_4PI_5);
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d a1r = _mm256_loadu_pd(inRe[1] + j), a1i = _mm256_loadu_pd(inIm[1] + j);
+        __m256d a2r = _mm256_loadu_pd(inRe[2] + j), a2i = _mm256_loadu_pd(inIm[2] + j);
+        __m256d a3r = _mm256_loadu_pd(inRe[3] + j), a3i = _mm256_loadu_pd(inIm[3] + j);
+        __m256d a4r = _mm256_loadu_pd(inRe[4] + j), a4i = _mm256_loadu_pd(inIm[4] + j);
+        __m256d b1r = _mm256_add_pd(a1r, a4r), b1i = _mm256_add_pd(a1i, a4i);
+        __m256d b2r = _mm256_add_pd(a2r, a3r), b2i = _mm256_add_pd(a2i, a3i);
+        __m256d d1r = _mm256_sub_pd(a1r, a4r), d1i = _mm256_sub_pd(a1i, a4i);
+        __m256d d2r = _mm256_sub_pd(a2r, a3r), d2i = _mm256_sub_pd(a2i, a3i);
+        __m256d ar = _mm256_loadu_pd(inRe[0] + j), ai = _mm256_loadu_pd(inIm[0] + j);
+        _mm256_storeu_pd(outRe[0] + j, _mm256_add_pd(ar, _mm256_add_pd(b1r, b2r)));
+        _mm256_storeu_pd(outIm[0] + j, _mm256_add_pd(ai, _mm256_add_pd(b1i, b2i)));
+        __m256d t1r = _mm256_fmadd_pd(c2, b2r, _mm256_fmadd_pd(c1, b1r, ar));
+        __m256d t1i = _mm256_fmadd_pd(c2, b2i, _mm256_fmadd_pd(c1, b1i, ai));
+        __m256d t2r = _mm256_fmadd_pd(c1, b2r, _mm256_fmadd_pd(c2, b1r, ar));
+        __m256d t2i = _mm256_fmadd_pd(c1, b2i, _mm256_fmadd_pd(c2, b1i, ai));
+        __m256d u1r = _mm256_fmadd_pd(s2, d2r, _mm256_mul_pd(s1, d1r));
+        __m256d u1i = _mm256_fmadd_pd(s2, d2i, _mm256_mul_pd(s1, d1i));
+        __m256d u2r = _mm256_fnmadd_pd(s1, d2r, _mm256_mul_pd(s2, d1r));
+        __m256d u2i = _mm256_fnmadd_pd(s1, d2i, _mm256_mul_pd(s2, d1i));
+        storeTwiddledAvx2(outRe[1] + j, outIm[1] + j, _mm256_add_pd(t1r, u1i), _mm256_sub_pd(t1i, u1r),
+                          _mm256_set1_pd(wr[0]), _mm256_set1_pd(wi[0]));
+        storeTwiddledAvx2(outRe[2] + j, outIm[2] + j, _mm256_add_pd(t2r, u2i), _mm256_sub_pd(t2i, u2r),
+                          _mm256_set1_pd(wr[1]), _mm256_set1_pd(wi[1]));
+        storeTwiddledAvx2(outRe[3] + j, outIm[3] + j, _mm256_sub_pd(t2r, u2i), _mm256_add_pd(t2i, u2r),
+                          _mm256_set1_pd(wr[2]), _mm256_set1_pd(wi[2]));
+        storeTwiddledAvx2(outRe[4] + j, outIm[4] + j, _mm256_sub_pd(t1r, u1i), _mm256_add_pd(t1i, u1r),
+                          _mm256_set1_pd(wr[3]), _mm256_set1_pd(wi[3]));
+    }
+    butterfly5Range(inRe, inIm, outRe, outIm, wr, wi, j, count);
+}
+
+#endif
+
+using OddButterfly = void (*)(const double *const *, const double *const *, double *const *, double *const *,
+                              const double *, const double *, int);
+
+struct Kernels {
+    void (*butterfly)(double *, double *, double *, double *, const double *, const double *, int);
+    void (*butterflyUniform)(double *, double *, double *, double *, double, double, int);
+    OddButterfly butterfly3, butterfly5;
+    const char *name;
+};
+
+// 按CPU支持的指令集选择一次
+inline const Kernels &kernels() {
+    static const Kernels selected = []() -> Kernels {
+#ifdef FFT_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return {butterflyAvx2, butterflyUniformAvx2, butterfly3Avx2, butterfly5Avx2, "avx2"};
+        }
+        return {butterflySse2, butterflyUniformSse2, butterfly3Scalar, butterfly5Scalar, "sse2"};
+#else
+        return {butterflyScalar, butterflyUniformScalar, butterfly3Scalar, butterfly5Scalar, "scalar"};
+#endif
+    }();
+    return selected;
+}
+
+} // namespace FftKernel
+
+inline int nextPowerOfTwo(int n) {
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+inline bool isPowerOfTwo(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+// Rough cost of an FftPlan of length len, in units of one radix-2 pass over len points. The mixed-radix path adds
+// a gather, a twiddle and a scatter pass, and each radix-3 or radix-5 stage counts as three or four passes. Its
+// Stockham stages work on runs of the power-of-two factor, so lengths where that factor is below 16 are not worth
+// planning and cost infinity.
+inline double fftCost(int len) {
+    int evenLen = 1;
+    while (len % (2 * evenLen) == 0) {
+        evenLen *= 2;
+    }
+    double passes = std::log2(static_cast<double>(evenLen));
+    int oddLen = len / evenLen;
+    if (oddLen > 1) {
+        if (evenLen < 16) {
+            return std::numeric_limits<double>::infinity();
+        }
+        passes += 4;
+    }
+    for (; oddLen % 5 == 0; oddLen /= 5) {
+        passes += 4;
+    }
+    for (; oddLen % 3 == 0; oddLen /= 3) {
+        passes += 3;
+    }
+    return static_cast<double>(len) * passes;
+}
+
+// FFT length planner: among the lengths of at least n with no prime factors other than 2, 3 and 5, the one with the
+// lowest fftCost. Against padding to the next power of two this saves up to half the points when n is just above
+// one, and keeps the power of two when the saving would not pay for the slower radix-3/5 stages.
+inline int nextFastSize(int n) {
+    const int limit = nextPowerOfTwo(n);
+    int best = limit;
+    for (int p5 = 1; p5 < limit; p5 *= 5) {
+        for (int p35 = p5; p35 < limit; p35 *= 3) {
+            int m = p35;
+            while (m < n) {
+                m <<= 1;
+            }
+            if (fftCost(m) < fftCost(best)) {
+                best = m;
+            }
+        }
+    }
+    return best;
+}
+
+// FFT length planner for the real 2D transforms: Fft2D needs an even width whose half is a fast size
+inline int nextFastEvenSize(int n) { return 2 * nextFastSize((std::max(n, 2) + 1) / 2); }
+
+// Unscaled complex FFT of a fixed length on split storage. The length must have no prime factors other than 2, 3
+// and 5 (see nextFastSize). Powers of two use the in-place radix-2 transform. Otherwise the length is split as
+// oddLen x evenLen: radix-3/5 Stockham stages run over whole runs of evenLen contiguous elements, and after the
+// twiddles every run gets the radix-2 transform, so both parts use long unit-stride loops.
+// The inverse transform is the forward transform with the real and imaginary arrays swapped.
+class FftPlan {
+  public:
+    int n;
+
+    explicit FftPlan(int n) : n(n), evenLen(1) {
+        while (n % (2 * evenLen) == 0) {
+            evenLen *= 2;
+        }
+        oddLen = n / evenLen;
+        rev.resize(evenLen);
+        twRe.resize(std::max(evenLen - 1, 1));
+        twIm.resize(std::max(evenLen - 1, 1));
+        int k = 0;
+        while ((1 << k) < evenLen) {
+            k++;
+        }
+        for (int i = 1; i < evenLen; i++) {
+            rev[i] = (rev[i >> 1] >> 1) | ((i & 1) << (k - 1));
+        }
+        // 半长为len的一层使用 [len-1, 2*len-1) 处的旋转因子
+        for (int len = 1; len < evenLen; len <<= 1) {
+            for (int j = 0; j < len; j++) {
+                double ang = -PI * j / len;
+                twRe[len - 1 + j] = std::cos(ang);
+                twIm[len - 1 + j] = std::sin(ang);
+            }
+        }
+        if (oddLen > 1) {
+            planOddFactor();
+        }
+    }
+
+    void forward(double *re, double *im) const {
+        if (oddLen > 1) {
+            mixedRadix(re, im, 1, 1);
+        } else {
+            radix2(re, im);
+        }
+    }
+
+    void inverse(double *re, double *im) const { forward(im, re); }
+
+    // Transform every column of a block of n rows, each holding `count` values `stride` apart
+    void forwardColumns(double *re, double *im, int count, int stride) const {
+        if (oddLen > 1) {
+            mixedRadix(re, im, count, stride);
+        } else {
+            radix2Columns(re, im, count, stride);
+        }
+    }
+
+    void inverseColumns(double *re, double *im, int count, int stride) const { forwardColumns(im, re, count, stride); }
+
+  private:
+    // n = evenLen * oddLen，evenLen 为 2 的幂，oddLen 只含因子 3 和 5
+    int evenLen, oddLen;
+    std::vector<int> rev;
+    std::vector<double> twRe, twIm;
+
+    // 奇数因子的一层：基数 radix，本层子序列长度 len，twRe/twIm[pp * (radix - 1) + k - 1] = exp(-2pi i pp k / len)
+    struct OddStage {
+        int radix, len;
+        std::vector<double> twRe, twIm;
+    };
+    std::vector<OddStage> oddStages;
+    // 两个因子之间的旋转因子，下标 k1 * evenLen + j2 处为 exp(-2pi i k1 j2 / n)
+    std::vector<double> mixRe, mixIm;
+
+    void planOddFactor() {
+        int len = oddLen;
+        for (int radix : {5, 3}) {
+            while (len % radix == 0) {
+                OddStage stage{radix, len, {}, {}};
+                const int m = len / radix;
+                stage.twRe.resize(m * (radix - 1));
+                stage.twIm.resize(m * (radix - 1));
+                for (int pp = 0; pp < m; pp++) {
+                    for (int k = 1; k < radix; k++) {
+                        double ang = -2 * PI * pp * k / len;
+                        stage.twRe[pp * (radix - 1) + k - 1] = std::cos(ang);
+                        stage.twIm[pp * (radix - 1) + k - 1] = std::sin(ang);
+                    }
+                }
+                oddStages.push_back(std::move(stage));
+                len = m;
+            }
+        }
+        assert(len == 1 && "FFT length may only have prime factors 2, 3 and 5");
+        mixRe.resize(n);
+        mixIm.resize(n);
+        for (int k1 = 0; k1 < oddLen; k1++) {
+            for (int j2 = 0; j2 < evenLen; j2++) {
+                double ang = -2 * PI * static_cast<double>(k1) * j2 / n;
+                mixRe[k1 * evenLen + j2] = std::cos(ang);
+                mixIm[k1 * evenLen + j2] = std::sin(ang);
+            }
+        }
+    }
+
+    // evenLen 点的原地基 2 变换
+    void radix2(double *re, double *im) const {
+        const int n = evenLen;
+        for (int i = 0; i < n; i++) {
+            if (i < rev[i]) {
+                std::swap(re[i], re[rev[i]]);
+                std::swap(im[i], im[rev[i]]);
+            }
+        }
+        for (int i = 0; i + 1 < n; i += 2) {
+            double tr = re[i + 1], ti = im[i + 1];
+            re[i + 1] = re[i] - tr;
+            im[i + 1] = im[i] - ti;
+            re[i] += tr;
+            im[i] += ti;
+        }
+        for (int i = 0; i + 3 < n; i += 4) {
+            // 旋转因子为 -i
+            double tr = re[i + 2], ti = im[i + 2];
+            re[i + 2] = re[i] - tr;
+            im[i + 2] = im[i] - ti;
+            re[i] += tr;
+            im[i] += ti;
+            tr = im[i + 3];
+            ti = -re[i + 3];
+            re[i + 3] = re[i + 1] - tr;
+            im[i + 3] = im[i + 1] - ti;
+            re[i + 1] += tr;
+            im[i + 1] += ti;
+        }
+        const FftKernel::Kernels &kern = FftKernel::kernels();
+        for (int len = 4; len < n; len <<= 1) {
+            const double *wr = twRe.data() + len - 1;
+            const double *wi = twIm.data() + len - 1;
+            for (int i = 0; i < n; i += 2 * len) {
+                kern.butterfly(re + i, im + i, re + i + len, im + i + len, wr, wi, len);
+            }
+        }
+    }
+
+    void radix2Columns(double *re, double *im, int count, int stride) const {
+        const int n = evenLen;
+        for (int i = 0; i < n; i++) {
+            if (i < rev[i]) {
+                std::swap_ranges(re + i * stride, re + i * stride + count, re + rev[i] * stride);
+                std::swap_ranges(im + i * stride, im + i * stride + count, im + rev[i] * stride);
+            }
+        }
+        const FftKernel::Kernels &kern = FftKernel::kernels();
+        for (int len = 1; len < n; len <<= 1) {
+            for (int i = 0; i < n; i += 2 * len) {
+                for (int j = 0; j < len; j++) {
+                    int a = (i + j) * stride, b = (i + j + len) * stride;
+                    kern.butterflyUniform(re + a, im + a, re + b, im + b, twRe[len - 1 + j], twIm[len - 1 + j], count);
+                }
+            }
+        }
+    }
+
+    // Element i of the sequence is the run of `count` values at i * stride. With i = j2 + evenLen * j1 and output
+    // index k1 + oddLen * k2, the Stockham stages transform over j1, leaving oddLen runs of evenLen elements in
+    // natural order in a scratch buffer; each run is twiddled, transformed over j2, and scattered to the output.
+    void mixedRadix(double *re, double *im, int count, int stride) const {
+        const int q = evenLen, m = oddLen;
+        const size_t size = static_cast<size_t>(n) * count;
+        // 每个线程复用自己的暂存区，避免每次变换都分配大块内存
+        thread_local std::vector<double> scratch;
+        if (scratch.size() < 4 * size) {
+            scratch.resize(4 * size);
+        }
+        double *const bufRe[2] = {scratch.data(), scratch.data() + 2 * size};
+        double *const bufIm[2] = {scratch.data() + size, scratch.data() + 3 * size};
+        const double *curRe = re, *curIm = im;
+        int next = 0;
+        if (stride != count) {
+            // 列变换的元素不连续，先收集到连续的暂存区
+            for (int i = 0; i < n; i++) {
+                std::copy(re + i * stride, re + i * stride + count, bufRe[1] + i * count);
+                std::copy(im + i * stride, im + i * stride + count, bufIm[1] + i * count);
+            }
+            curRe = bufRe[1];
+            curIm = bufIm[1];
+        }
+        // 奇数因子部分的元素是 evenLen 个连续元素，共 q * count 个值
+        const int width = q * count;
+        const FftKernel::Kernels &kern = FftKernel::kernels();
+        int s = 1;
+        for (const OddStage &stage : oddStages) {
+            const int p = stage.radix, len = stage.len / p;
+            for (int pp = 0; pp < len; pp++) {
+                const double *wr = stage.twRe.data() + pp * (p - 1), *wi = stage.twIm.data() + pp * (p - 1);
+                for (int g = 0; g < s; g++) {
+                    const double *inRe[5], *inIm[5];
+                    double *outRe[5], *outIm[5];
+                    for (int r = 0; r < p; r++) {
+                        inRe[r] = curRe + static_cast<size_t>(g + s * (pp + r * len)) * width;
+                        inIm[r] = curIm + static_cast<size_t>(g + s * (pp + r * len)) * width;
+                        outRe[r] = bufRe[next] + static_cast<size_t>(g + s * (p * pp + r)) * width;
+                        outIm[r] = bufIm[next] + static_cast<size_t>(g + s * (p * pp + r)) * width;
+                    }
+                    (p == 3 ? kern.butterfly3 : kern.butterfly5)(inRe, inIm, outRe, outIm, wr, wi, width);
+                }
+            }
+            curRe = bufRe[next];
+            curIm = bufIm[next];
+            next ^= 1;
+            s *= p;
+        }
+        double *runRe = bufRe[next ^ 1], *runIm = bufIm[next ^ 1];
+        for (int k1 = 0; k1 < m; k1++) {
+            double *xr = runRe + static_cast<size_t>(k1) * width, *xi = runIm + static_cast<size_t>(k1) * width;
+            const double *wr = mixRe.data() + k1 * q, *wi = mixIm.data() + k1 * q;
+            for (int j2 = 1; j2 < q; j2++) {
+                for (int c = j2 * count; c < (j2 + 1) * count; c++) {
+                    double tr = xr[c];
+                    xr[c] = tr * wr[j2] - xi[c] * wi[j2];
+                    xi[c] = tr * wi[j2] + xi[c] * wr[j2];
+                }
+            }
+            if (count == 1) {
+                radix2(xr, xi);
+            } else {
+                radix2Columns(xr, xi, count, count);
+            }
+            for (int k2 = 0; k2 < q; k2++) {
+                std::copy(xr + k2 * count, xr + (k2 + 1) * count, re + (k1 + m * k2) * stride);
+                std::copy(xi + k2 * count, xi + (k2 + 1) * count, im + (k1 + m * k2) * stride);
+            }
+        }
+    }
+};
+
+// 2D transforms between a height x width real image and its height x (width/2+1) half spectrum.
+// width must be even, and height and width/2 must have no prime factors other than 2, 3 and 5 (see nextFastSize).
+// Rows use a half-length complex FFT of the even/odd pixel pairs; columns are transformed in cache-sized strips.
+class Fft2D {
+  public:
+    int height, width, specWidth;
+
+    Fft2D(int height, int width)
+        : height(height), width(width), specWidth(width / 2 + 1), rowPlan(width / 2), colPlan(height),
+          wRe(width / 2 + 1), wIm(width / 2 + 1) {
+        for (int k = 0; k <= width / 2; k++) {
+            double ang = -2 * PI * k / width;
+            wRe[k] = std::cos(ang);
+            wIm[k] = std::sin(ang);
+        }
+    }
+
+    int spectrumSize() const { return height * specWidth; }
+
+    // Plans are immutable once built, so one instance per size is shared by every caller
+    static std::shared_ptr<const Fft2D> cached(int height, int width) {
+        static std::mutex lock;
+        static std::map<std::pair<int, int>, std::shared_ptr<const Fft2D>> plans;
+        std::lock_guard<std::mutex> guard(lock);
+        auto &plan = plans[{height, width}];
+        if (!plan) {
+            plan = std::make_shared<const Fft2D>(height, width);
+        }
+        return plan;
+    }
+
+    // Number of forwardReal and inverseReal calls so far over all plans and threads
+    static std::atomic<int64> &transformCount() {
+        static std::atomic<int64> count{0};
+        return count;
+    }
+
+    // in: height*width real values; re/im: height*specWidth spectrum
+    void forwardReal(const double *in, double *re, double *im) const {
+        PROFILE_SCOPE(FftForward);
+        transformCount().fetch_add(1, std::memory_order_relaxed);
+        const int half = width / 2;
+        for (int r = 0; r < height; r++) {
+            const double *x = in + r * width;
+            double *zr = re + r * specWidth;
+            double *zi = im + r * specWidth;
+            for (int k = 0; k < half; k++) {
+                zr[k] = x[2 * k];
+                zi[k] = x[2 * k + 1];
+            }
+            rowPlan.forward(zr, zi);
+            // 由偶数位与奇数位的频谱合成整行频谱
+            double z0r = zr[0], z0i = zi[0];
+            zr[0] = z0r + z0i;
+            zi[0] = 0;
+            zr[half] = z0r - z0i;
+            zi[half] = 0;
+            for (int k = 1; k <= half / 2; k++) {
+                int m = half - k;
+                double er = (zr[k] + zr[m]) / 2, ei = (zi[k] - zi[m]) / 2;
+                double orr = (zi[k] + zi[m]) / 2, oi = (zr[m] - zr[k]) / 2;
+                double tr = wRe[k] * orr - wIm[k] * oi;
+                double ti = wRe[k] * oi + wIm[k] * orr;
+                zr[k] = er + tr;
+                zi[k] = ei + ti;
+                if (m != k) {
+                    zr[m] = er - tr;
+                    zi[m] = ti - ei;
+                }
+            }
+        }
+        transformColumns(re, im, false);
+    }
+
+    // re/im: height*specWidth spectrum (overwritten); out: height*width real values, scaled by 1/(height*width)
+    void inverseReal(double *re, double *im, double *out) const {
+        PROFILE_SCOPE(FftInverse);
+        transformCount().fetch_add(1, std::memory_order_relaxed);
+        const int half = width / 2;
+        transformColumns(re, im, true);
+        const double scale = 1.0 / (static_cast<double>(height) * half);
+        for (int r = 0; r < height; r++) {
+            double *zr = re + r * specWidth;
+            double *zi = im + r * specWidth;
+            double x0r = zr[0], x0i = zi[0], xhr = zr[half], xhi = zi[half];
+            zr[0] = (x0r + xhr) / 2 - (x0i + xhi) / 2;
+            zi[0] = (x0i - xhi) / 2 + (x0r - xhr) / 2;
+            for (int k = 1; k <= half / 2; k++) {
+                int m = half - k;
+                double er = (zr[k] + zr[m]) / 2, ei = (zi[k] - zi[m]) / 2;
+                double dr = (zr[k] - zr[m]) / 2, di = (zi[k] + zi[m]) / 2;
+                double orr = dr * wRe[k] + di * wIm[k];
+                double oi = di * wRe[k] - dr * wIm[k];
+                zr[k] = er - oi;
+                zi[k] = ei + orr;
+                if (m != k) {
+                    zr[m] = er + oi;
+                    zi[m] = orr - ei;
+                }
+            }
+            rowPlan.inverse(zr, zi);
+            double *x = out + r * width;
+            for (int k = 0; k < half; k++) {
+                x[2 * k] = zr[k] * scale;
+                x[2 * k + 1] = zi[k] * scale;
+            }
+        }
+    }
+
+  private:
+    static constexpr int COLUMN_BLOCK = 32;
+
+    FftPlan rowPlan, colPlan;
+    std::vector<double> wRe, wIm;
+
+    void transformColumns(double *re, double *im, bool invert) const {
+        for (int c = 0; c < specWidth; c += COLUMN_BLOCK) {
+            int count = std::min(COLUMN_BLOCK, specWidth - c);
+            if (invert) {
+                colPlan.inverseColumns(re + c, im + c, count, specWidth);
+            } else {
+                colPlan.forwardColumns(re + c, im + c, count, specWidth);
+            }
+        }
+    }
+};
+
+// Linear convolution of two integer sequences
+inline std::vector<int64> fft(const std::vector<int64> &a, const std::vector<int64> &b) {
+    int n = nextPowerOfTwo(a.size() + b.size());
+    std::vector<double> re(n), im(n);
+    for (int i = 0; i < (int)a.size(); i++) {
+        re[i] = a[i];
+        im[i] = b[i];
+    }
+
+    FftPlan plan(n);
+    plan.forward(re.data(), im.data());
+    for (int i = 0; i < n; i++) {
+        double r = re[i] * re[i] - im[i] * im[i];
+        im[i] = 2 * re[i] * im[i];
+        re[i] = r;
+    }
+    plan.inverse(re.data(), im.data());
+
+    std::vector<int64> result(n);
+    for (int i = 0; i < n; i++) {
+        result[i] = std::round(im[i] / n / 2);
+    }
+    return result;
+}
+
+} // namespace Utils
+
+#endif
@@ -1,22 +1,60 @@
 #ifndef _IMAGE_HPP
 #define _IMAGE_HPP
 
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
 #include <stdexcept>
 #include <vector>
 
 #include "constants.h"
 
+// 仅在调试构建（build.sh -g 定义 IMAGE_BOUNDS_CHECK）时检查下标，发布构建中为空操作
+inline void checkImageIndex(int index, int size) {
+#ifdef IMAGE_BOUNDS_CHECK
+    if (index < 0 || index >= size) {
+        throw std::out_of_range("Index out of bounds");
+    }
+#else
+    (void)index;
+    (void)size;
+#endif
+}
+
+// Allocator returning memory aligned to Alignment bytes, for buffers read by SIMD code
+template <typename T, size_t Alignment> struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U> struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// 8-bit grayscale image. An Image either owns its pixels, every row starting on a ROW_ALIGNMENT-byte boundary,
+// or is a view of pixels owned elsewhere (a caller's array, a file mapping or another Image). Copying an owning
+// image copies the pixels; copying a view copies only the reference.
 class Image {
   public:
+    static constexpr int ROW_ALIGNMENT = 32;
+    static constexpr size_t BUFFER_ALIGNMENT = 64;
+
     // Non-const access to a row using an integer index
     class Row {
       public:
         Row(uint8 *rowPtr, int width) : rowPtr(rowPtr), width(width) {}
 
         uint8 &operator[](int col) {
-            if (col < 0 || col >= width) {
-                throw std::out_of_range("Index out of bounds");
-            }
+            checkImageIndex(col, width);
             return rowPtr[col];
         }
 
@@ -31,9 +69,7 @@ class Image {
         ConstRow(const uint8 *rowPtr, int width) : rowPtr(rowPtr), width(width) {}
 
         const uint8 &operator[](int col) const {
-            if (col < 0 || col >= width) {
-                throw std::out_of_range("Index out of bounds");
-            }
+            checkImageIndex(col, width);
             return rowPtr[col];
         }
 
@@ -47,45 +83,132 @@ class Image {
     // Constructor
     Image() : Image(0, 0) {}
 
-    // Constructor
-    Image(int height, int width) : height(height), width(width), data(height * width) {}
+    // Constructor, zero-filled
+    Image(int height, int width)
+        : height(height), width(width), rowStride(alignedStride(width)),
+          data(static_cast<size_t>(height) * rowStride), base(data.data()), ownsPixels(true) {}
+
+    // Constructor, copying height * width row-major pixels
+    Image(int height, int width, const uint8 *pixels) : Image(height, width) {
+        for (int i = 0; i < height; i++) {
+            std::copy(pixels + static_cast<size_t>(i) * width, pixels + static_cast<size_t>(i + 1) * width, row(i));
+        }
+    }
+
+    Image(const Image &other) : height(other.height), width(other.width) { copyFrom(other); }
+
+    Image &operator=(const Image &other) {
+        if (this != &other) {
+            height = other.height;
+            width = other.width;
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    // 移动时缓冲区随 vector 一起转移，base 仍然有效
+    Image(Image &&) = default;
+    Image &operator=(Image &&) = default;
+
+    // Non-owning view of height rows of width pixels, rows being stride pixels apart. The memory must outlive
+    // the view unless `owner` keeps it alive.
+    static Image view(uint8 *pixels, int height, int width, int stride, std::shared_ptr<const void> owner = nullptr) {
+        Image image;
+        image.height = height;
+        image.width = width;
+        image.rowStride = stride;
+        image.base = pixels;
+        image.ownsPixels = false;
+        image.keepAlive = std::move(owner);
+        return image;
+    }
+
+    static Image view(uint8 *pixels, int height, int width) { return view(pixels, height, width, width); }
+
+    // Zero-copy view of the h x w window whose top-left pixel is (x, y). It refers to this image's pixels, so it
+    // must not outlive an owning image it was cut from.
+    Image crop(int x, int y, int h, int w) const {
+        checkImageIndex(x + h - 1, height);
+        checkImageIndex(y + w - 1, width);
+        return view(base + static_cast<size_t>(x) * rowStride + y, h, w, rowStride, keepAlive);
+    }
+
+    // Owning copy with aligned rows, also for views
+    Image clone() const {
+        Image image(height, width);
+        for (int i = 0; i < height; i++) {
+            std::copy(row(i), row(i) + width, image.row(i));
+        }
+        return image;
+    }
+
+    bool isView() const { return !ownsPixels; }
 
     // Non-const access to an individual pixel using a (row, col) pair
     uint8 &operator[](std::pair<int, int> position) {
         int row = position.first;
         int col = position.second;
-        if (row < 0 || row >= height || col < 0 || col >= width) {
-            throw std::out_of_range("Index out of bounds");
-        }
-        return data[row * width + col];
+        checkImageIndex(row, height);
+        checkImageIndex(col, width);
+        return base[static_cast<size_t>(row) * rowStride + col];
     }
 
     // Const access to an individual pixel using a (row, col) pair
     const uint8 &operator[](std::pair<int, int> position) const {
         int row = position.first;
         int col = position.second;
-        if (row < 0 || row >= height || col < 0 || col >= width) {
-            throw std::out_of_range("Index out of bounds");
-        }
-        return data[row * width + col];
+        checkImageIndex(row, height);
+        checkImageIndex(col, width);
+        return base[static_cast<size_t>(row) * rowStride + col];
     }
 
     Row operator[](int rowIndex) {
-        if (rowIndex < 0 || rowIndex >= height) {
-            throw std::out_of_range("Index out of bounds");
-        }
-        return Row(data.data() + rowIndex * width, width);
+        checkImageIndex(rowIndex, height);
+        return Row(base + static_cast<size_t>(rowIndex) * rowStride, width);
     }
 
     ConstRow operator[](int rowIndex) const {
-        if (rowIndex < 0 || rowIndex >= height) {
-            throw std::out_of_range("Index out of bounds");
-        }
-        return ConstRow(data.data() + rowIndex * width, width);
+        checkImageIndex(rowIndex, height);
+        return ConstRow(base + static_cast<size_t>(rowIndex) * rowStride, width);
     }
 
+    // Pointer to the first pixel of a row for inner loops. Only the row index is checked, and only in debug
+    // builds; rows are stride() pixels apart.
+    uint8 *row(int rowIndex) {
+        checkImageIndex(rowIndex, height);
+        return base + static_cast<size_t>(rowIndex) * rowStride;
+    }
+
+    const uint8 *row(int rowIndex) const {
+        checkImageIndex(rowIndex, height);
+        return base + static_cast<size_t>(rowIndex) * rowStride;
+    }
+
+    // Distance in pixels between the starts of two consecutive rows
+    int stride() const { return rowStride; }
+
   private:
-    std::vector<uint8> data;
+    int rowStride;
+    std::vector<uint8, AlignedAllocator<uint8, BUFFER_ALIGNMENT>> data;
+    uint8 *base;
+    bool ownsPixels;
+    // 视图所引用内存的所有者（例如文件映射），为空表示由调用者保证其生命周期
+    std::shared_ptr<const void> keepAlive;
+
+    static int alignedStride(int width) { return (width + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT; }
+
+    void copyFrom(const Image &other) {
+        rowStride = other.rowStride;
+        ownsPixels = other.ownsPixels;
+        keepAlive = other.keepAlive;
+        if (ownsPixels) {
+            data = other.data;
+            base = data.data();
+        } else {
+            data.clear();
+            base = other.base;
+        }
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,243 @@
+#ifndef _IMAGE_IO_CPP
+#define _IMAGE_IO_CPP
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "image.hpp"
+#include "jpeg_decoder.hpp"
+
+// 二进制灰度图格式：4 字节魔数 "TMG1"，小端序 uint32 的高和宽，之后逐行存放 uint8 像素
+const char BINARY_IMAGE_MAGIC[4] = {'T', 'M', 'G', '1'};
+const int BINARY_IMAGE_HEADER = 12;
+
+// Private (copy-on-write) memory mapping of a whole file. Pages are shared with the page cache until written, so
+// views of the mapping may be modified without touching the file.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ptr = static_cast<uint8 *>(p);
+                length = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (ptr != nullptr) {
+            munmap(ptr, length);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    uint8 *data() const { return ptr; }
+    size_t size() const { return length; }
+
+  private:
+    uint8 *ptr = nullptr;
+    size_t length = 0;
+};
+
+namespace ImageIO {
+
+uint32_t readLittleEndian32(const uint8 *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+bool isBinaryImage(const uint8 *p, size_t length) {
+    return length >= BINARY_IMAGE_HEADER && std::memcmp(p, BINARY_IMAGE_MAGIC, 4) == 0;
+}
+
+// Parse an in-memory binary image, returning false on a malformed header. With an owner of the memory the result
+// is a view of the pixels instead of a copy.
+bool decodeBinaryImage(uint8 *p, size_t length, Image &image, std::shared_ptr<const void> owner = nullptr) {
+    if (!isBinaryImage(p, length)) {
+        return false;
+    }
+    uint32_t height = readLittleEndian32(p + 4);
+    uint32_t width = readLittleEndian32(p + 8);
+    if (height == 0 || width == 0 || (length - BINARY_IMAGE_HEADER) / width < height) {
+        return false;
+    }
+    if (owner) {
+        // 映射为写时复制，通过视图写入只修改进程内的副本
+        image = Image::view(p + BINARY_IMAGE_HEADER, height, width, width, std::move(owner));
+    } else {
+        image = Image(height, width, p + BINARY_IMAGE_HEADER);
+    }
+    return true;
+}
+
+bool isPnmImage(const uint8 *p, size_t length) { return length >= 2 && p[0] == 'P' && (p[1] == '5' || p[1] == '6'); }
+
+bool isJpegImage(const uint8 *p, size_t length) { return length >= 2 && p[0] == 0xFF && p[1] == 0xD8; }
+
+// 读取 PNM 头部的下一个十进制数，跳过空白与 # 注释
+bool readPnmNumber(const uint8 *p, size_t length, size_t &pos, uint32_t &value) {
+    while (pos < length && (std::isspace(p[pos]) || p[pos] == '#')) {
+        if (p[pos] == '#') {
+            while (pos < length && p[pos] != '\n') {
+                pos++;
+            }
+        } else {
+            pos++;
+        }
+    }
+    if (pos >= length || !std::isdigit(p[pos])) {
+        return false;
+    }
+    value = 0;
+    while (pos < length && std::isdigit(p[pos]) && value < (1u << 24)) {
+        value = value * 10 + (p[pos++] - '0');
+    }
+    return true;
+}
+
+// Parse a binary PGM (P5) or PPM (P6). Samples wider than 8 bits are scaled down; PPM colour is reduced to
+// luma with the ITU-R BT.601 weights.
+bool decodePnmImage(const uint8 *p, size_t length, Image &image) {
+    if (!isPnmImage(p, length)) {
+        return false;
+    }
+    const int channels = p[1] == '5' ? 1 : 3;
+    size_t pos = 2;
+    uint32_t width, height, maxValue;
+    if (!readPnmNumber(p, length, pos, width) || !readPnmNumber(p, length, pos, height) ||
+        !readPnmNumber(p, length, pos, maxValue) || pos >= length || !std::isspace(p[pos])) {
+        return false;
+    }
+    pos++;
+    const int sampleBytes = maxValue > 255 ? 2 : 1;
+    if (width == 0 || height == 0 || maxValue == 0 || maxValue > 65535 ||
+        (length - pos) / ((size_t)width * channels * sampleBytes) < height) {
+        return false;
+    }
+    auto sample = [&](size_t index) -> uint32_t {
+        const uint8 *q = p + pos + index * sampleBytes;
+        return sampleBytes == 2 ? (q[0] << 8) | q[1] : q[0];
+    };
+    image = Image(height, width);
+    for (uint32_t i = 0; i < height; i++) {
+        for (uint32_t j = 0; j < width; j++) {
+            size_t index = ((size_t)i * width + j) * channels;
+            uint32_t v = channels == 1
+                             ? sample(index)
+                             : (299 * sample(index) + 587 * sample(index + 1) + 114 * sample(index + 2) + 500) / 1000;
+            image[i][j] = (v * 255 + maxValue / 2) / maxValue;
+        }
+    }
+    return true;
+}
+
+// 解码 JPEG 的亮度分量；不支持的编码方式会在标准错误输出原因
+bool decodeJpegImage(const uint8 *p, size_t length, Image &image) {
+    int height, width;
+    std::vector<unsigned char> pixels;
+    std::string error;
+    if (!Jpeg::decodeGray(p, length, height, width, pixels, error)) {
+        fprintf(stderr, "JPEG: %s\n", error.c_str());
+        return false;
+    }
+    image = Image(height, width, pixels.data());
+    return true;
+}
+
+// 读取一张文本格式的灰度图，输入结束时返回 false
+bool readTextImage(std::istream &fin, Image &image) {
+    int n, m;
+    if (!(fin >> n >> m)) {
+        return false;
+    }
+    image = Image(n, m);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < m; j++) {
+            int v;
+            fin >> v;
+            image[i][j] = v;
+        }
+    }
+    return static_cast<bool>(fin);
+}
+
+// 从流中读取下一张图，按开头是否为魔数区分二进制与文本格式
+bool readImage(std::istream &fin, Image &image) {
+    fin >> std::ws;
+    if (fin.peek() != BINARY_IMAGE_MAGIC[0]) {
+        return readTextImage(fin, image);
+    }
+    uint8 header[BINARY_IMAGE_HEADER];
+    if (!fin.read(reinterpret_cast<char *>(header), BINARY_IMAGE_HEADER) ||
+        std::memcmp(header, BINARY_IMAGE_MAGIC, 4) != 0) {
+        return false;
+    }
+    uint32_t height = readLittleEndian32(header + 4);
+    uint32_t width = readLittleEndian32(header + 8);
+    if (height == 0 || width == 0) {
+        return false;
+    }
+    image = Image(height, width);
+    for (uint32_t i = 0; i < height; i++) {
+        fin.read(reinterpret_cast<char *>(&image[i][0]), width);
+    }
+    return static_cast<bool>(fin);
+}
+
+// Load an image file in any supported format, told apart by its leading bytes. Binary formats (TMG1, PGM/PPM,
+// JPEG) are mapped instead of read through a stream, and a TMG1 image is returned as a view of the mapping.
+bool loadImage(const std::string &path, Image &image) {
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        uint8 *p = file->data();
+        if (p != nullptr) {
+            if (isBinaryImage(p, file->size())) {
+                // 像素直接引用映射的内存，图像存活期间映射保持有效
+                return decodeBinaryImage(p, file->size(), image, file);
+            }
+            if (isPnmImage(p, file->size())) {
+                return decodePnmImage(p, file->size(), image);
+            }
+            if (isJpegImage(p, file->size())) {
+                return decodeJpegImage(p, file->size(), image);
+            }
+        }
+    }
+    std::ifstream fin(path);
+    return readTextImage(fin, image);
+}
+
+// 按二进制、文本、PGM、JPEG 的顺序使用用例目录中第一个存在的 name 文件
+std::string findImageFile(const std::string &dataFolder, const std::string &name) {
+    for (const char *extension : {".bin", ".txt", ".pgm", ".jpg"}) {
+        std::string path = dataFolder + "/" + name + extension;
+        if (std::filesystem::exists(path)) {
+            return path;
+        }
+    }
+    return dataFolder + "/" + name + ".txt";
+}
+
+} // namespace ImageIO
+
+#endif
@@ -0,0 +1,575 @@
+#ifndef _JPEG_DECODER_HPP
+#define _JPEG_DECODER_HPP
+
+// Self-contained JPEG decoder producing 8-bit grayscale (the first component, i.e. luma for YCbCr files).
+// Supports baseline and extended Huffman (SOF0/SOF1) and progressive (SOF2) 8-bit images with any chroma
+// subsampling and restart intervals. Arithmetic coding, lossless and 12-bit JPEG are rejected.
+// Depends only on the standard library.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Jpeg {
+
+namespace Detail {
+
+// Position of the k-th zigzag coefficient in natural (row-major) order
+const int ZIGZAG[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+                        41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+                        30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+struct HuffmanTable {
+    bool defined = false;
+    int maxCode[18];
+    int valueOffset[17];
+    unsigned char values[256];
+};
+
+struct Component {
+    int id = 0, h = 1, v = 1, tq = 0;
+    int blocksPerLine = 0, blocksPerColumn = 0;       // blocks covering the component itself
+    int blocksPerLineMcu = 0, blocksPerColumnMcu = 0; // blocks covering whole MCUs
+    int dcTable = 0, acTable = 0;
+    int dcPred = 0;
+    std::vector<short> coefs;                 // natural order, not dequantized
+
+    short *block(int row, int col) { return coefs.data() + (row * blocksPerLineMcu + col) * 64; }
+};
+
+class Decoder {
+  public:
+    Decoder(const unsigned char *data, size_t size) : data(data), size(size) {}
+
+    int width = 0, height = 0;
+    std::vector<unsigned char> pixels;
+    std::string error;
+
+    bool decode() {
+        if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+            return fail("not a JPEG file");
+        }
+        pos = 2;
+        while (true) {
+            int marker = nextMarker();
+            if (marker < 0) {
+                return fail("unexpected end of file");
+            }
+            if (marker == 0xD9) {
+                break;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+                continue;
+            }
+            if (pos + 2 > size) {
+                return fail("truncated segment");
+            }
+            size_t length = (data[pos] << 8) | data[pos + 1];
+            if (length < 2 || pos + length > size) {
+                return fail("truncated segment");
+            }
+            size_t end = pos + length;
+            pos += 2;
+            bool ok = true;
+            switch (marker) {
+            case 0xC0:
+            case 0xC1:
+            case 0xC2:
+                ok = readFrame(marker == 0xC2, end);
+                break;
+            case 0xC4:
+                ok = readHuffmanTables(end);
+                break;
+            case 0xDB:
+                ok = readQuantizationTables(end);
+                break;
+            case 0xDD:
+                if (length < 4) {
+                    return fail("bad restart interval");
+                }
+                restartInterval = (data[pos] << 8) | data[pos + 1];
+                break;
+            case 0xDA:
+                ok = readScan(end);
+                break;
+            default:
+                if ((marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)) {
+                    return fail("unsupported JPEG process (only Huffman baseline/progressive)");
+                }
+                break;
+            }
+            if (!ok) {
+                return false;
+            }
+            if (marker != 0xDA) {
+                pos = end;
+            }
+        }
+        if (components.empty()) {
+            return fail("no frame header");
+        }
+        outputGray();
+        return true;
+    }
+
+  private:
+    const unsigned char *data;
+    size_t size;
+    size_t pos = 0;
+
+    bool progressive = false;
+    int restartInterval = 0;
+    int hMax = 1, vMax = 1, mcusPerLine = 0, mcusPerColumn = 0;
+    int quant[4][64] = {};
+    HuffmanTable dcTables[4], acTables[4];
+    std::vector<Component> components;
+
+    // 熵编码数据的位读取状态
+    unsigned int bitBuffer = 0;
+    int bitCount = 0;
+    bool markerHit = false;
+    int eobRun = 0;
+
+    bool fail(const char *message) {
+        error = message;
+        return false;
+    }
+
+    int nextMarker() {
+        while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] != 0xFF && data[pos + 1] != 0x00)) {
+            pos++;
+        }
+        if (pos + 1 >= size) {
+            return -1;
+        }
+        int marker = data[pos + 1];
+        pos += 2;
+        return marker;
+    }
+
+    bool readQuantizationTables(size_t end) {
+        while (pos < end) {
+            int precision = data[pos] >> 4, id = data[pos] & 15;
+            pos++;
+            if (id > 3 || pos + 64 * (precision + 1) > end) {
+                return fail("bad quantization table");
+            }
+            for (int k = 0; k < 64; k++) {
+                int q = precision ? (data[pos] << 8) | data[pos + 1] : data[pos];
+                pos += precision + 1;
+                quant[id][ZIGZAG[k]] = q;
+            }
+        }
+        return true;
+    }
+
+    bool readHuffmanTables(size_t end) {
+        while (pos < end) {
+            int tableClass = data[pos] >> 4, id = data[pos] & 15;
+            pos++;
+            if (id > 3 || pos + 16 > end) {
+                return fail("bad Huffman table");
+            }
+            HuffmanTable &table = tableClass == 0 ? dcTables[id] : acTables[id];
+            int counts[17] = {0}, total = 0;
+            for (int len = 1; len <= 16; len++) {
+                counts[len] = data[pos++];
+                total += counts[len];
+            }
+            if (total > 256 || pos + total > end) {
+                return fail("bad Huffman table");
+            }
+            std::copy(data + pos, data + pos + total, table.values);
+            pos += total;
+            // 规范哈夫曼编码：记录每个长度的最大码字与值的偏移
+            int code = 0, k = 0;
+            for (int len = 1; len <= 16; len++) {
+                table.valueOffset[len] = k - code;
+                code += counts[len];
+                k += counts[len];
+                table.maxCode[len] = counts[len] ? code - 1 : -1;
+                code <<= 1;
+            }
+            table.maxCode[17] = 0x7fffffff;
+            table.defined = true;
+        }
+        return true;
+    }
+
+    bool readFrame(bool isProgressive, size_t end) {
+        if (!components.empty()) {
+            return fail("multiple frames");
+        }
+        if (pos + 6 > end || data[pos] != 8) {
+            return fail("only 8-bit JPEG is supported");
+        }
+        progressive = isProgressive;
+        height = (data[pos + 1] << 8) | data[pos + 2];
+        width = (data[pos + 3] << 8) | data[pos + 4];
+        int count = data[pos + 5];
+        pos += 6;
+        if (width == 0 || height == 0 || count == 0 || pos + 3 * count > end) {
+            return fail("bad frame header");
+        }
+        for (int i = 0; i < count; i++) {
+            Component c;
+            c.id = data[pos];
+            c.h = data[pos + 1] >> 4;
+            c.v = data[pos + 1] & 15;
+            c.tq = data[pos + 2] & 3;
+            pos += 3;
+            if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4) {
+                return fail("bad sampling factors");
+            }
+            hMax = std::max(hMax, c.h);
+            vMax = std::max(vMax, c.v);
+            components.push_back(c);
+        }
+        mcusPerLine = (width + 8 * hMax - 1) / (8 * hMax);
+        mcusPerColumn = (height + 8 * vMax - 1) / (8 * vMax);
+        for (Component &c : components) {
+            c.blocksPerLine = ((width * c.h + hMax - 1) / hMax + 7) / 8;
+            c.blocksPerColumn = ((height * c.v + vMax - 1) / vMax + 7) / 8;
+            c.blocksPerLineMcu = mcusPerLine * c.h;
+            c.blocksPerColumnMcu = mcusPerColumn * c.v;
+            c.coefs.assign(static_cast<size_t>(c.blocksPerLineMcu) * c.blocksPerColumnMcu * 64, 0);
+        }
+        return true;
+    }
+
+    int readBit() {
+        if (bitCount == 0) {
+            int byte = 0;
+            if (!markerHit && pos < size) {
+                byte = data[pos];
+                if (byte == 0xFF) {
+                    int next = pos + 1 < size ? data[pos + 1] : 0xD9;
+                    if (next == 0x00) {
+                        pos += 2;
+                    } else {
+                        // 遇到标记：不再前进，之后补 0
+                        markerHit = true;
+                        byte = 0;
+                    }
+                } else {
+                    pos++;
+                }
+            }
+            bitBuffer = byte;
+            bitCount = 8;
+        }
+        bitCount--;
+        return (bitBuffer >> bitCount) & 1;
+    }
+
+    int readBits(int n) {
+        int v = 0;
+        for (int i = 0; i < n; i++) {
+            v = (v << 1) | readBit();
+        }
+        return v;
+    }
+
+    int receiveExtend(int n) {
+        if (n == 0 || n > 16) {
+            return 0;
+        }
+        int v = readBits(n);
+        return v < (1 << (n - 1)) ? v - (1 << n) + 1 : v;
+    }
+
+    int decodeHuffman(const HuffmanTable &table) {
+        int code = 0;
+        for (int len = 1; len <= 16; len++) {
+            code = (code << 1) | readBit();
+            if (code <= table.maxCode[len]) {
+                return table.values[(table.valueOffset[len] + code) & 0xff];
+            }
+        }
+        return 0;
+    }
+
+    void resetEntropyState() {
+        bitCount = 0;
+        markerHit = false;
+        eobRun = 0;
+        for (Component &c : components) {
+            c.dcPred = 0;
+        }
+    }
+
+    void decodeBlockBaseline(Component &c, short *coef) {
+        int t = decodeHuffman(dcTables[c.dcTable]);
+        c.dcPred = static_cast<short>(c.dcPred + receiveExtend(t));
+        coef[0] = c.dcPred;
+        for (int k = 1; k < 64;) {
+            int rs = decodeHuffman(acTables[c.acTable]);
+            int r = rs >> 4, s = rs & 15;
+            if (s == 0) {
+                if (r != 15) {
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += r;
+            if (k > 63) {
+                break;
+            }
+            coef[ZIGZAG[k]] = receiveExtend(s);
+            k++;
+        }
+    }
+
+    void decodeBlockDc(Component &c, short *coef, int ah, int al) {
+        if (ah == 0) {
+            int t = decodeHuffman(dcTables[c.dcTable]);
+            c.dcPred = static_cast<short>(c.dcPred + receiveExtend(t));
+            coef[0] = c.dcPred * (1 << al);
+        } else if (readBit()) {
+            coef[0] |= 1 << al;
+        }
+    }
+
+    void decodeBlockAcFirst(Component &c, short *coef, int ss, int se, int al) {
+        if (eobRun > 0) {
+            eobRun--;
+            return;
+        }
+        for (int k = ss; k <= se;) {
+            int rs = decodeHuffman(acTables[c.acTable]);
+            int r = rs >> 4, s = rs & 15;
+            if (s == 0) {
+                if (r < 15) {
+                    eobRun = (1 << r) - 1 + readBits(r);
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += r;
+            if (k > 63) {
+                break;
+            }
+            coef[ZIGZAG[k]] = receiveExtend(s) * (1 << al);
+            k++;
+        }
+    }
+
+    void refineNonZero(short &value, int bit) {
+        if (readBit() && (value & bit) == 0) {
+            value += value > 0 ? bit : -bit;
+        }
+    }
+
+    void decodeBlockAcRefine(Component &c, short *coef, int ss, int se, int al) {
+        const int bit = 1 << al;
+        int k = ss;
+        if (eobRun > 0) {
+            eobRun--;
+            for (; k <= se; k++) {
+                if (coef[ZIGZAG[k]] != 0) {
+                    refineNonZero(coef[ZIGZAG[k]], bit);
+                }
+            }
+            return;
+        }
+        while (k <= se) {
+            int rs = decodeHuffman(acTables[c.acTable]);
+            int r = rs >> 4, s = rs & 15;
+            int value = 0;
+            if (s == 0) {
+                if (r < 15) {
+                    // 本块剩余部分只做细化
+                    eobRun = (1 << r) - 1 + readBits(r);
+                    r = 64;
+                }
+            } else {
+                value = readBit() ? bit : -bit;
+            }
+            while (k <= se) {
+                short &z = coef[ZIGZAG[k++]];
+                if (z != 0) {
+                    refineNonZero(z, bit);
+                } else {
+                    if (r == 0) {
+                        z = value;
+                        break;
+                    }
+                    r--;
+                }
+            }
+        }
+    }
+
+    bool readScan(size_t end) {
+        if (components.empty()) {
+            return fail("scan before frame header");
+        }
+        if (pos >= end) {
+            return fail("bad scan header");
+        }
+        int count = data[pos++];
+        if (count < 1 || count > 4 || pos + 2 * count + 3 > end) {
+            return fail("bad scan header");
+        }
+        std::vector<Component *> scan;
+        for (int i = 0; i < count; i++) {
+            int id = data[pos], tables = data[pos + 1];
+            pos += 2;
+            Component *found = nullptr;
+            for (Component &c : components) {
+                if (c.id == id) {
+                    found = &c;
+                }
+            }
+            if (found == nullptr) {
+                return fail("scan references unknown component");
+            }
+            found->dcTable = tables >> 4 & 3;
+            found->acTable = tables & 3;
+            scan.push_back(found);
+        }
+        int ss = data[pos], se = data[pos + 1], ah = data[pos + 2] >> 4, al = data[pos + 2] & 15;
+        pos = end;
+        if (!progressive) {
+            ss = 0;
+            se = 63;
+            ah = al = 0;
+        }
+        if (ss > se || se > 63 || al > 13 || (progressive && ss > 0 && count != 1)) {
+            return fail("bad progressive scan parameters");
+        }
+        for (Component *c : scan) {
+            bool needDc = !progressive || ss == 0;
+            bool needAc = !progressive || ss > 0;
+            if ((needDc && ah == 0 && !dcTables[c->dcTable].defined) || (needAc && !acTables[c->acTable].defined)) {
+                return fail("scan uses an undefined Huffman table");
+            }
+        }
+        resetEntropyState();
+
+        auto decodeBlock = [&](Component &c, short *coef) {
+            if (!progressive) {
+                decodeBlockBaseline(c, coef);
+            } else if (ss == 0) {
+                decodeBlockDc(c, coef, ah, al);
+            } else if (ah == 0) {
+                decodeBlockAcFirst(c, coef, ss, se, al);
+            } else {
+                decodeBlockAcRefine(c, coef, ss, se, al);
+            }
+        };
+        // 单分量扫描按分量自身的块排列，多分量扫描按 MCU 交错排列
+        int mcuTotal = count == 1 ? scan[0]->blocksPerLine * scan[0]->blocksPerColumn : mcusPerLine * mcusPerColumn;
+        for (int mcu = 0; mcu < mcuTotal; mcu++) {
+            if (restartInterval > 0 && mcu > 0 && mcu % restartInterval == 0) {
+                if (!skipRestartMarker()) {
+                    return fail("missing restart marker");
+                }
+                resetEntropyState();
+            }
+            if (count == 1) {
+                Component &c = *scan[0];
+                decodeBlock(c, c.block(mcu / c.blocksPerLine, mcu % c.blocksPerLine));
+                continue;
+            }
+            int mcuRow = mcu / mcusPerLine, mcuCol = mcu % mcusPerLine;
+            for (Component *c : scan) {
+                for (int by = 0; by < c->v; by++) {
+                    for (int bx = 0; bx < c->h; bx++) {
+                        decodeBlock(*c, c->block(mcuRow * c->v + by, mcuCol * c->h + bx));
+                    }
+                }
+            }
+        }
+        // 跳到下一个标记之前
+        while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] != 0x00 &&
+                                   !(data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7))) {
+            pos++;
+        }
+        return true;
+    }
+
+    bool skipRestartMarker() {
+        while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) {
+            pos++;
+        }
+        if (pos + 1 >= size) {
+            return false;
+        }
+        pos += 2;
+        return true;
+    }
+
+    void outputGray() {
+        Component &c = components[0];
+        const int planeWidth = c.blocksPerLineMcu * 8;
+        std::vector<unsigned char> plane(static_cast<size_t>(planeWidth) * c.blocksPerColumnMcu * 8);
+        double cosTable[8][8];
+        for (int x = 0; x < 8; x++) {
+            for (int u = 0; u < 8; u++) {
+                cosTable[x][u] = (u == 0 ? std::sqrt(0.5) : 1.0) * std::cos((2 * x + 1) * u * M_PI / 16) / 2;
+            }
+        }
+        for (int row = 0; row < c.blocksPerColumn; row++) {
+            for (int col = 0; col < c.blocksPerLine; col++) {
+                const short *coef = c.block(row, col);
+                double f[64], tmp[64];
+                for (int k = 0; k < 64; k++) {
+                    f[k] = coef[k] * quant[c.tq][k];
+                }
+                // 可分离的二维 IDCT：先按行，再按列
+                for (int v = 0; v < 8; v++) {
+                    for (int x = 0; x < 8; x++) {
+                        double sum = 0;
+                        for (int u = 0; u < 8; u++) {
+                            sum += cosTable[x][u] * f[v * 8 + u];
+                        }
+                        tmp[v * 8 + x] = sum;
+                    }
+                }
+                for (int y = 0; y < 8; y++) {
+                    for (int x = 0; x < 8; x++) {
+                        double sum = 0;
+                        for (int v = 0; v < 8; v++) {
+                            sum += cosTable[y][v] * tmp[v * 8 + x];
+                        }
+                        int value = static_cast<int>(std::lround(sum + 128));
+                        plane[(row * 8 + y) * planeWidth + col * 8 + x] = std::clamp(value, 0, 255);
+                    }
+                }
+            }
+        }
+        // 分量分辨率低于图像时按最近邻放大
+        pixels.resize(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; y++) {
+            int sy = y * c.v / vMax;
+            for (int x = 0; x < width; x++) {
+                pixels[static_cast<size_t>(y) * width + x] = plane[sy * planeWidth + x * c.h / hMax];
+            }
+        }
+    }
+};
+
+} // namespace Detail
+
+// Decode a whole JPEG file held in memory into 8-bit grayscale, row-major
+inline bool decodeGray(const unsigned char *data, size_t size, int &height, int &width,
+                       std::vector<unsigned char> &pixels, std::string &error) {
+    Detail::Decoder decoder(data, size);
+    if (!decoder.decode()) {
+        error = decoder.error;
+        return false;
+    }
+    height = decoder.height;
+    width = decoder.width;
+    pixels = std::move(decoder.pixels);
+    return true;
+}
+
+} // namespace Jpeg
+
+#endif
@@ -1,30 +1,18 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 
 #include "constants.h"
+#include "image_io.cpp"
+#include "match_accelerated.cpp"
+#include "match_joint.cpp"
+#include "match_pyramid.cpp"
 #include "match_scale.cpp"
-
-uint8 cImage[S_SIZE][S_SIZE], cTemplate[T_SIZE][T_SIZE];
-
-template <int H, int W> void readImage(uint8 data[H][W], std::string path) {
-    std::ifstream fin(path);
-    int n, m;
-    fin >> n >> m;
-    assert(n == H && m == W);
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < m; j++) {
-            int v;
-            fin >> v;
-            data[i][j] = v;
-        }
-    }
-}
-
-void readData(std::string dataFolder) {
-    readImage<T_SIZE, T_SIZE>(cTemplate, dataFolder + "/template.txt");
-    readImage<S_SIZE, S_SIZE>(cImage, dataFolder + "/image.txt");
-}
+#include "match_stream.cpp"
+#include "tiled_match.cpp"
 
 void formatPath(std::string &path) {
     assert(path.length() > 0);
@@ -37,15 +25,170 @@ void formatPath(std::string &path) {
     }
 }
 
+// 在一串目标图中跟踪同一个模板，每帧输出一行结果。frameFolder 为空时从标准输入依次读取
+void streamMatch(const std::string &templatePath, SearchMode mode, const std::string &frameFolder) {
+    Image vt;
+    if (!ImageIO::loadImage(templatePath, vt)) {
+        fprintf(stderr, "Cannot read template %s\n", templatePath.c_str());
+        return;
+    }
+    StreamMatcher matcher(vt, mode);
+    auto report = [&](const std::string &name, const Image &frame) {
+        auto [value, result] = matcher.match(frame);
+        std::cout << name << ' ' << result.x << ' ' << result.y;
+        if (mode != SearchMode::Plain) {
+            std::cout << ' ' << value;
+        }
+        std::cout << std::endl;
+    };
+    if (frameFolder.empty()) {
+        Image frame;
+        for (int id = 0; ImageIO::readImage(std::cin, frame); id++) {
+            report(std::to_string(id), frame);
+        }
+        return;
+    }
+    std::vector<std::filesystem::path> framePaths;
+    for (const auto &entry : std::filesystem::directory_iterator(frameFolder)) {
+        if (entry.is_regular_file()) {
+            framePaths.push_back(entry.path());
+        }
+    }
+    std::sort(framePaths.begin(), framePaths.end());
+    for (const auto &path : framePaths) {
+        Image frame;
+        if (ImageIO::loadImage(path.string(), frame)) {
+            report(path.filename().string(), frame);
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <data-folder>\n", argv[0]);
+    std::string folderPath, imagePath, templateFile, templatePath;
+    std::string modeName = "scale";
+    // -1 表示未指定，此时只有联合检测使用金字塔
+    int pyramidLevel = -1;
+    // 大于 0 时输出至多 topK 个实例
+    int topK = 0;
+    // 搜索结束后向 stderr 输出各探针的调用次数与耗时
+    bool profile = false;
+    bool usageError = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-j" && i + 1 < argc) {
+            ThreadPool::setGlobalWorkerNum(std::atoi(argv[++i]));
+        } else if (arg == "--pyramid" && i + 1 < argc) {
+            pyramidLevel = std::atoi(argv[++i]);
+        } else if (arg == "--score" && i + 1 < argc) {
+            ScoreMode scoreMode;
+            if (parseScoreMode(argv[++i], scoreMode)) {
+                setGlobalScoreMode(scoreMode);
+            } else {
+                usageError = true;
+            }
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--top" && i + 1 < argc) {
+            topK = std::atoi(argv[++i]);
+        } else if (arg == "--stream" && i + 1 < argc) {
+            templatePath = argv[++i];
+        } else if (arg == "--mode" && i + 1 < argc) {
+            modeName = argv[++i];
+            if (modeName != "plain" && modeName != "orient" && modeName != "scale" && modeName != "joint") {
+                usageError = true;
+            }
+        } else if (folderPath.empty() && imagePath.empty()) {
+            folderPath = arg;
+        } else if (imagePath.empty()) {
+            // 两个位置参数时依次为目标图文件与模板文件
+            imagePath = folderPath;
+            folderPath.clear();
+            templateFile = arg;
+        } else {
+            usageError = true;
+        }
+    }
+    if (usageError || (folderPath.empty() && imagePath.empty() && templatePath.empty()) ||
+        (!imagePath.empty() && !templatePath.empty()) || (!templatePath.empty() && modeName == "joint") ||
+        (topK > 0 && (!templatePath.empty() || modeName == "joint"))) {
+        printf("Usage: %s [-j <threads>] [--pyramid <level>] [--mode plain|orient|scale|joint] [--top <k>] "
+               "[--score ssd|cc|ncc|zncc] [--profile] <data-folder>\n",
+               argv[0]);
+        printf("       %s [-j <threads>] [--pyramid <level>] [--mode plain|orient|scale|joint] [--top <k>] "
+               "[--score ssd|cc|ncc|zncc] [--profile] <image-file> <template-file>\n",
+               argv[0]);
+        printf("       %s [-j <threads>] --stream <template-file> [--mode plain|orient|scale] "
+               "[--score ssd|cc|ncc|zncc] [--profile] [<frame-folder>]\n",
+               argv[0]);
+        return 0;
+    }
+    if (!templatePath.empty()) {
+        if (!folderPath.empty()) {
+            formatPath(folderPath);
+        }
+        SearchMode mode = modeName == "plain"    ? SearchMode::Plain
+                          : modeName == "orient" ? SearchMode::Orient
+                                                 : SearchMode::Scale;
+        const Profile::Totals before = Profile::snapshot();
+        streamMatch(templatePath, mode, folderPath);
+        if (profile) {
+            Profile::report(stderr, Profile::snapshot() - before);
+        }
         return 0;
     }
-    std::string folderPath(argv[1]);
-    formatPath(folderPath);
-    readData(folderPath);
-    int x, y;
-    Match_also_scale(cImage, cTemplate, x, y);
-    std::cout << x << ' ' << y << std::endl;
+    if (imagePath.empty()) {
+        formatPath(folderPath);
+        imagePath = ImageIO::findImageFile(folderPath, "image");
+        templateFile = ImageIO::findImageFile(folderPath, "template");
+    }
+    Image image, templateImage;
+    if (!ImageIO::loadImage(imagePath, image) || !ImageIO::loadImage(templateFile, templateImage)) {
+        fprintf(stderr, "Cannot read %s or %s\n", imagePath.c_str(), templateFile.c_str());
+        return 1;
+    }
+    const Profile::Totals before = Profile::snapshot();
+    if (topK > 0) {
+        // 每个实例一行：X Y [角度/放缩比]
+        if (modeName == "plain") {
+            for (const MatchResult &result : Match_accelerated_topk(image, templateImage, topK)) {
+                std::cout << result.x << ' ' << result.y << std::endl;
+            }
+        } else {
+            auto results = modeName == "orient" ? Match_also_orient_topk(image, templateImage, topK)
+                                                : Match_also_scale_topk(image, templateImage, topK);
+            for (const auto &[value, result] : results) {
+                std::cout << result.x << ' ' << result.y << ' ' << value << std::endl;
+            }
+        }
+    } else {
+        int x = -1, y = -1;
+        if (modeName == "plain") {
+            if (static_cast<int64>(image.height) * image.width > static_cast<int64>(S_SIZE) * S_SIZE) {
+                // 大图按块计算相关，内存占用与块大小有关而与目标图大小无关
+                MatchResult result = tiledMatch(image, templateImage);
+                fprintf(stderr, "Score=%f\n", result.score);
+                x = result.x;
+                y = result.y;
+            } else {
+                Match_accelerated(image, templateImage, x, y);
+            }
+        } else if (modeName == "orient") {
+            if (pyramidLevel > 0) {
+                Match_also_orient_pyramid(image, templateImage, x, y, pyramidLevel);
+            } else {
+                Match_also_orient(image, templateImage, x, y);
+            }
+        } else if (modeName == "joint") {
+            Match_also_orient_scale(image, templateImage, x, y,
+                                    pyramidLevel >= 0 ? pyramidLevel : DEFAULT_PYRAMID_LEVEL);
+        } else if (pyramidLevel > 0) {
+            Match_also_scale_pyramid(image, templateImage, x, y, pyramidLevel);
+        } else {
+            Match_also_scale(image, templateImage, x, y);
+        }
+        std::cout << x << ' ' << y << std::endl;
+    }
+    if (profile) {
+        Profile::report(stderr, Profile::snapshot() - before);
+    }
 }
\ No newline at end of file
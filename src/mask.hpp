@@ -0,0 +1,139 @@
+#ifndef _MASK_HPP
+#define _MASK_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include "constants.h"
+#include "image.hpp"
+
+// Template mask with the geometry of an Image, stored as one bit per pixel in 64-bit words. Every row starts
+// on a new word and the bits past `width` are always zero, so row scans and counts work a word at a time.
+class Mask {
+  public:
+    int height, width;
+
+    // Constructor
+    Mask() : Mask(0, 0) {}
+
+    // Constructor, every pixel set to value
+    Mask(int height, int width, bool value = false)
+        : height(height), width(width), words((width + 63) / 64), bits(static_cast<size_t>(height) * words, 0) {
+        if (value && words > 0) {
+            for (int i = 0; i < height; i++) {
+                uint64 *row = rowWords(i);
+                std::fill(row, row + words, ~0ULL);
+                row[words - 1] = tailMask();
+            }
+        }
+    }
+
+    bool test(int row, int col) const {
+        checkImageIndex(row, height);
+        checkImageIndex(col, width);
+        return (rowWords(row)[col >> 6] >> (col & 63)) & 1;
+    }
+
+    void set(int row, int col, bool value = true) {
+        checkImageIndex(row, height);
+        checkImageIndex(col, width);
+        uint64 bit = 1ULL << (col & 63);
+        if (value) {
+            rowWords(row)[col >> 6] |= bit;
+        } else {
+            rowWords(row)[col >> 6] &= ~bit;
+        }
+    }
+
+    // Number of words in a row, and the words themselves; bit j of word k is pixel 64 * k + j
+    int wordsPerRow() const { return words; }
+    uint64 *rowWords(int row) { return bits.data() + static_cast<size_t>(row) * words; }
+    const uint64 *rowWords(int row) const { return bits.data() + static_cast<size_t>(row) * words; }
+
+    // Number of set pixels
+    int64 count() const {
+        int64 total = 0;
+        for (uint64 word : bits) {
+            total += __builtin_popcountll(word);
+        }
+        return total;
+    }
+
+    bool full() const { return count() == static_cast<int64>(height) * width; }
+
+    // Column of the first set pixel in a row, -1 if the row is empty
+    int firstInRow(int row) const {
+        const uint64 *p = rowWords(row);
+        for (int k = 0; k < words; k++) {
+            if (p[k] != 0) {
+                return k * 64 + __builtin_ctzll(p[k]);
+            }
+        }
+        return -1;
+    }
+
+    // Row of the first set pixel in a column, -1 if the column is empty
+    int firstInColumn(int col) const {
+        checkImageIndex(col, width);
+        for (int i = 0; i < height; i++) {
+            if ((rowWords(i)[col >> 6] >> (col & 63)) & 1) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Smallest rectangle holding every set pixel, as inclusive bounds. Returns false for an empty mask.
+    bool boundingBox(int &minRow, int &minCol, int &maxRow, int &maxCol) const {
+        minRow = height;
+        minCol = width;
+        maxRow = maxCol = -1;
+        for (int i = 0; i < height; i++) {
+            const uint64 *p = rowWords(i);
+            int first = 0;
+            while (first < words && p[first] == 0) {
+                first++;
+            }
+            if (first == words) {
+                continue;
+            }
+            int last = words - 1;
+            while (p[last] == 0) {
+                last--;
+            }
+            minRow = std::min(minRow, i);
+            maxRow = i;
+            minCol = std::min(minCol, first * 64 + __builtin_ctzll(p[first]));
+            maxCol = std::max(maxCol, last * 64 + 63 - __builtin_clzll(p[last]));
+        }
+        return maxRow >= 0;
+    }
+
+    // Copy of the h x w window whose top-left pixel is (x, y)
+    Mask crop(int x, int y, int h, int w) const {
+        Mask result(h, w);
+        const int shift = y & 63;
+        for (int i = 0; i < h; i++) {
+            const uint64 *src = rowWords(x + i) + (y >> 6);
+            const int srcWords = words - (y >> 6);
+            uint64 *dst = result.rowWords(i);
+            for (int k = 0; k < result.words; k++) {
+                uint64 word = src[k] >> shift;
+                if (shift != 0 && k + 1 < srcWords) {
+                    word |= src[k + 1] << (64 - shift);
+                }
+                dst[k] = k + 1 < result.words ? word : word & result.tailMask();
+            }
+        }
+        return result;
+    }
+
+  private:
+    int words;
+    std::vector<uint64> bits;
+
+    // 每行最后一个字中属于图像的位
+    uint64 tailMask() const { return width % 64 == 0 ? ~0ULL : (1ULL << (width % 64)) - 1; }
+};
+
+#endif
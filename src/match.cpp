@@ -1,38 +1,160 @@
+#ifndef _MATCH_CPP
+#define _MATCH_CPP
+
 #include <climits>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SSD_X86
+#endif
+
 #include "constants.h"
+#include "image.hpp"
 
-const int64 SCORE_THRESHOLD = (int64)(256 * 256 / 3) * (T_SIZE * T_SIZE) / 16 * DETECT_SENSITIVITY;
+// 判定匹配成功的 SSD 上限，与模板面积成正比
+inline int64 ssdThreshold(int templateArea) {
+    return (int64)(256 * 256 / 3) * templateArea / 16 * DETECT_SENSITIVITY;
+}
+
+const int64 SCORE_THRESHOLD = ssdThreshold(T_SIZE * T_SIZE);
 
 int scoreFunc(int sPixel, int tPixel) {
     int delta = sPixel - tPixel;
     return delta * delta;
 }
 
-bool Match(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
-    int bestScore = INT_MAX;
-    for (int bx = 0; bx <= S_SIZE - T_SIZE; bx++) {
-        for (int by = 0; by <= S_SIZE - T_SIZE; by++) {
-            int score = 0;
-            for (int dx = 0; dx < T_SIZE; dx++) {
-                for (int dy = 0; dy < T_SIZE; dy++) {
-                    int sx = bx + dx;
-                    int sy = by + dy;
-                    int tx = dx;
-                    int ty = dy;
-                    score += scoreFunc(s[sx][sy], t[tx][ty]);
-                }
+// Sum of scoreFunc over `count` consecutive pixels of one row. Every variant computes the same integer.
+namespace SsdKernel {
+
+inline int rowSsdScalar(const uint8 *s, const uint8 *t, int count) {
+    int sum = 0;
+    for (int j = 0; j < count; j++) {
+        sum += scoreFunc(s[j], t[j]);
+    }
+    return sum;
+}
+
+#ifdef SSD_X86
+
+// 每个差值的平方不超过 255^2，两两相加后仍在 32 位整数内
+inline int rowSsdSse2(const uint8 *s, const uint8 *t, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    int j = 0;
+    for (; j + 16 <= count; j += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + j));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t + j));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc) + rowSsdScalar(s + j, t + j, count - j);
+}
+
+__attribute__((target("avx2"))) inline int rowSsdAvx2(const uint8 *s, const uint8 *t, int count) {
+    __m256i acc = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 16 <= count; j += 16) {
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + j)));
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(t + j)));
+        __m256i d = _mm256_sub_epi16(a, b);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum) + rowSsdScalar(s + j, t + j, count - j);
+}
+
+#endif
+
+using RowSsd = int (*)(const uint8 *, const uint8 *, int);
+
+// 按CPU支持的指令集选择一次
+inline RowSsd rowSsd() {
+    static const RowSsd selected = []() -> RowSsd {
+#ifdef SSD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return rowSsdAvx2;
+        }
+        return rowSsdSse2;
+#else
+        return rowSsdScalar;
+#endif
+    }();
+    return selected;
+}
+
+} // namespace SsdKernel
+
+// Exact brute-force SSD search, kept as the reference the FFT matchers are checked against. Its result is the
+// same as the plain four-deep loop over every position and pixel: the smallest sum of scoreFunc, ties going to
+// the first position in raster order.
+//
+// A cheap pass over every PREDICT_STEP-th position and template row predicts where the best match lies, and that
+// position is scored in full first so the bound is tight from the start. The raster scan then adds whole template
+// rows with a SIMD kernel and abandons a position as soon as its partial sum can no longer win. The success
+// threshold scales with the template area.
+bool Match(const Image &s, const Image &t, int &retX, int &retY) {
+    const int PREDICT_STEP = 4;
+    const int rangeX = s.height - t.height, rangeY = s.width - t.width;
+    if (rangeX < 0 || rangeY < 0) {
+        return false;
+    }
+    const SsdKernel::RowSsd rowSsd = SsdKernel::rowSsd();
+
+    // 预测：位置与模板行都每隔 PREDICT_STEP 取一个
+    int64 predictScore = LLONG_MAX;
+    int predictX = 0, predictY = 0;
+    for (int bx = 0; bx <= rangeX; bx += PREDICT_STEP) {
+        for (int by = 0; by <= rangeY; by += PREDICT_STEP) {
+            int64 score = 0;
+            for (int dx = 0; dx < t.height; dx += PREDICT_STEP) {
+                score += rowSsd(s.row(bx + dx) + by, t.row(dx), t.width);
+            }
+            if (score < predictScore) {
+                predictScore = score;
+                predictX = bx;
+                predictY = by;
+            }
+        }
+    }
+
+    int64 bestScore = 0;
+    for (int dx = 0; dx < t.height; dx++) {
+        bestScore += rowSsd(s.row(predictX + dx) + predictY, t.row(dx), t.width);
+    }
+    int bestX = predictX, bestY = predictY;
+    for (int bx = 0; bx <= rangeX; bx++) {
+        for (int by = 0; by <= rangeY; by++) {
+            // 得分相同时光栅序在前的位置胜出，所以在当前最优之后的位置只有严格更小才能胜出
+            const bool afterBest = bx > bestX || (bx == bestX && by >= bestY);
+            const int64 limit = afterBest ? bestScore - 1 : bestScore;
+            int64 score = 0;
+            for (int dx = 0; dx < t.height && score <= limit; dx++) {
+                score += rowSsd(s.row(bx + dx) + by, t.row(dx), t.width);
             }
-            if (score < bestScore) {
+            if (score <= limit) {
                 bestScore = score;
-                retX = bx;
-                retY = by;
+                bestX = bx;
+                bestY = by;
             }
         }
     }
-    if (bestScore < SCORE_THRESHOLD) {
+    retX = bestX;
+    retY = bestY;
+    if (bestScore < ssdThreshold(t.height * t.width)) {
         return true;
     } else {
         return false;
     }
-}
\ No newline at end of file
+}
+
+bool Match(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
+    return Match(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX, retY);
+}
+
+#endif
@@ -1,29 +1,59 @@
+#ifndef _MATCH_ACCELERATED_CPP
+#define _MATCH_ACCELERATED_CPP
+
 #include <vector>
 
 #include "constants.h"
 #include "fast_match.cpp"
+#include "thread_pool.hpp"
 
-bool Match_accelerated(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
-    Image vs(S_SIZE, S_SIZE);
-    Image vt(T_SIZE, T_SIZE);
-    std::vector tMask(T_SIZE, std::vector<bool>(T_SIZE, true));
-    for (int i = 0; i < S_SIZE; i++) {
-        for (int j = 0; j < S_SIZE; j++) {
-            vs[i][j] = s[i][j];
-        }
-    }
-    for (int i = 0; i < T_SIZE; i++) {
-        for (int j = 0; j < T_SIZE; j++) {
-            vt[i][j] = t[i][j];
-        }
-    }
-    auto result = fastMatch(vs, vt, tMask);
+// 得分高于 threshold 时判定匹配成功，默认使用当前评分方式的阈值
+bool Match_accelerated(const Image &vs, const Image &vt, int &retX, int &retY, double threshold = scoreThreshold()) {
+    auto result = fastMatch(vs, vt);
     fprintf(stderr, "Score=%f\n", result.score);
-    if (result.score > 0.9) {
+    if (result.score > threshold) {
         retX = result.x;
         retY = result.y;
         return true;
     } else {
         return false;
     }
-}
\ No newline at end of file
+}
+
+bool Match_accelerated(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY,
+                       double threshold = scoreThreshold()) {
+    // 直接引用调用者的数组，不复制像素
+    return Match_accelerated(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX,
+                             retY, threshold);
+}
+
+// 检测目标图中模板的多个实例，按得分从高到低返回至多 k 个得分不低于 threshold、彼此不重叠的位置
+std::vector<MatchResult> Match_accelerated_topk(const Image &vs, const Image &vt, int k,
+                                                double threshold = scoreThreshold()) {
+    auto results = fastMatchTopK(PreparedTarget(vs), vt, k, threshold);
+    for (const MatchResult &result : results) {
+        fprintf(stderr, "Score=%f, X=%d, Y=%d\n", result.score, result.x, result.y);
+    }
+    return results;
+}
+
+std::vector<MatchResult> Match_accelerated_topk(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int k,
+                                                double threshold = scoreThreshold()) {
+    return Match_accelerated_topk(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), k,
+                                  threshold);
+}
+
+// 同一目标图上匹配 n 个模板，目标图的频谱只计算一次，各模板在线程池中并行匹配
+std::vector<MatchResult> Match_accelerated_batch(uint8 s[S_SIZE][S_SIZE], uint8 t[][T_SIZE][T_SIZE], int n) {
+    PreparedTarget target(Image::view(&s[0][0], S_SIZE, S_SIZE));
+    std::vector<MatchResult> results(n);
+    ThreadPool::global().parallelFor(n, [&](int k) {
+        results[k] = fastMatch(target, Image::view(&t[k][0][0], T_SIZE, T_SIZE));
+    });
+    for (int k = 0; k < n; k++) {
+        fprintf(stderr, "Template=%d, Score=%f\n", k, results[k].score);
+    }
+    return results;
+}
+
+#endif
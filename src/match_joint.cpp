@@ -0,0 +1,231 @@
+#ifndef _MATCH_JOINT_CPP
+#define _MATCH_JOINT_CPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include "constants.h"
+#include "fast_match.cpp"
+#include "match_orient.cpp"
+#include "match_pyramid.cpp"
+#include "match_scale.cpp"
+#include "refine.hpp"
+#include "thread_pool.hpp"
+
+// 同时包含位置、旋转角度与放缩比的匹配结果，坐标为原模板左上角所在的位置
+struct PoseMatchResult {
+    double score;
+    int x, y;
+    float rad, scale;
+};
+
+// 模板先放缩再旋转后在目标图上的最佳匹配
+PoseMatchResult testPose(const PreparedTarget &vs, const Image &vt, float rad, float scale) {
+    Image scaledT;
+    scaleImage(vt, scale, scaledT);
+    if (scaledT.height < 1 || scaledT.width < 1) {
+        return {-std::numeric_limits<double>::infinity(), -1, -1, rad, scale};
+    }
+    auto result = testRad(vs, scaledT, rad);
+    return {result.score, result.x, result.y, rad, scale};
+}
+
+// 联合搜索的粗网格在放缩比上比 getCoarseScale 更密：角度同样稀疏时，大模板偏离真实角度的得分下降更多，
+// 需要更细的放缩比网格才能让正确的候选留在前列
+const int JOINT_SCALE_STEP_NUM = 12;
+
+float getJointScale(int id, const ScaleRange &range) { return range.at(id, JOINT_SCALE_STEP_NUM); }
+
+// 放缩、旋转后模板的外接矩形能否放进 height x width 的目标图
+bool poseFits(const Image &vt, float rad, float scale, int height, int width) {
+    float c = std::abs(std::cos(rad)), s = std::abs(std::sin(rad));
+    float h = vt.height * scale, w = vt.width * scale;
+    return h * c + w * s <= height && h * s + w * c <= width;
+}
+
+// refinePeak 的停止条件：放缩比区间窄到模板长边变化不足一个像素，与 findPeekScale 相同；最近邻放缩的得分呈阶梯状，
+// 只做黄金分割步
+RefineOptions jointScaleOptions(const Image &vt) {
+    RefineOptions options;
+    options.tolerance = 1.0f / std::max(vt.height, vt.width);
+    options.parabolic = false;
+    return options;
+}
+
+// 角度区间窄到放缩后模板外接圆上的点移动不足一个像素，与 findPeekRad 相同
+RefineOptions jointAngleOptions(const Image &vt, float scale) {
+    RefineOptions options;
+    options.tolerance = 2 / std::hypot(vt.height * scale, vt.width * scale);
+    return options;
+}
+
+// Joint orientation and scale search. The coarse grid of ORIENT_STEP_NUM angles x JOINT_SCALE_STEP_NUM log-spaced
+// scales is evaluated at pyramid `level`, skipping cells whose transformed template cannot fit in the target. The
+// best angle peaks of every scale are screened by a short angle search at full resolution. The unrotated,
+// unscaled template, which the grid never samples, joins them as one more candidate when it fits. The best few
+// candidates are refined inside a window around each by alternating refinePeak searches over scale and angle.
+// Cells and peaks run on the thread pool; the reduction is in a fixed order, so the result does not depend on the
+// thread count.
+PoseMatchResult searchPose(const Image &vs, const Image &vt, int level = DEFAULT_PYRAMID_LEVEL) {
+    const int ANGLE_NUM = ORIENT_STEP_NUM;
+    const int SCALE_NUM = JOINT_SCALE_STEP_NUM;
+    const int ROW_PEAK_NUM = 2;
+    const int MAX_SEARCH_NUM = 3;
+    const int REFINE_ROUNDS = 2;
+    // 筛选只做几次试探
+    const int SCREEN_PROBES = 5;
+    const double NEG_INF = -std::numeric_limits<double>::infinity();
+    ThreadPool &pool = ThreadPool::global();
+    const ScaleRange range = ScaleRange::of(vs.height, vs.width, vt.height, vt.width);
+
+    int factor = 1 << std::max(level, 0);
+    while (factor > 1 && (vt.height / factor < 4 || vt.width / factor < 4)) {
+        factor /= 2;
+    }
+    const Image lowS = factor > 1 ? ImageUtil::downsample(vs, factor) : vs;
+    const Image lowT = factor > 1 ? ImageUtil::downsample(vt, factor) : vt;
+    PreparedTarget lowTarget(lowS);
+
+    // Coarse grid, cell (a, k) at index a * SCALE_NUM + k
+    std::vector<PoseMatchResult> grid(ANGLE_NUM * SCALE_NUM);
+    pool.parallelFor(ANGLE_NUM * SCALE_NUM, [&](int id) {
+        float rad = getOrientRad(id / SCALE_NUM), scale = getJointScale(id % SCALE_NUM, range);
+        if (!poseFits(vt, rad, scale, vs.height, vs.width)) {
+            grid[id] = {NEG_INF, -1, -1, rad, scale};
+            return;
+        }
+        grid[id] = testPose(lowTarget, lowT, rad, scale);
+        grid[id].x *= factor;
+        grid[id].y *= factor;
+    });
+
+    // 每个放缩比上取角度方向（循环）得分最高的至多 ROW_PEAK_NUM 个局部极大值作为候选
+    std::vector<int> candidates;
+    for (int k = 0; k < SCALE_NUM; k++) {
+        std::vector<int> rowPeaks;
+        for (int a = 0; a < ANGLE_NUM; a++) {
+            double current = grid[a * SCALE_NUM + k].score;
+            double last = grid[(a + ANGLE_NUM - 1) % ANGLE_NUM * SCALE_NUM + k].score;
+            double next = grid[(a + 1) % ANGLE_NUM * SCALE_NUM + k].score;
+            if (current != NEG_INF && current >= last && current > next) {
+                rowPeaks.push_back(a * SCALE_NUM + k);
+            }
+        }
+        std::stable_sort(rowPeaks.begin(), rowPeaks.end(), [&](int x, int y) { return grid[x].score > grid[y].score; });
+        rowPeaks.resize(std::min<int>(rowPeaks.size(), ROW_PEAK_NUM));
+        candidates.insert(candidates.end(), rowPeaks.begin(), rowPeaks.end());
+    }
+
+    const float angleStep = getOrientRad(1) - getOrientRad(0);
+    const float scaleRatio = getJointScale(1, range) / getJointScale(0, range);
+    // 以粗搜索得到的模板中心为中心、能容纳 scale * maxRatio 倍模板的子图
+    auto window = [&](const PoseMatchResult &pose, float maxRatio) {
+        float d = std::atan2(static_cast<float>(vt.height), static_cast<float>(vt.width)) + pose.rad;
+        float dlen = pose.scale * std::sqrt(static_cast<float>(vt.height * vt.height + vt.width * vt.width)) / 2;
+        float centerX = pose.x + dlen * std::sin(d), centerY = pose.y + dlen * std::cos(d);
+        float half = dlen * maxRatio + 2 * factor + 2;
+        int lx = std::max<int>(centerX - half, 0), ly = std::max<int>(centerY - half, 0);
+        int rx = std::min<int>(centerX + half + 1, vs.height), ry = std::min<int>(centerY + half + 1, vs.width);
+        return std::make_tuple(lx, ly, std::max(rx - lx, 0), std::max(ry - ly, 0));
+    };
+
+    // 粗网格在角度上过于稀疏，大模板偏离真实角度时得分下降更多。先在原分辨率下只细化各候选的角度，
+    // 用细化后的得分在不同放缩比之间公平比较
+    std::vector<PoseMatchResult> screened(candidates.size());
+    pool.parallelFor(candidates.size(), [&](int i) {
+        const PoseMatchResult &coarse = grid[candidates[i]];
+        auto [lx, ly, h, w] = window(coarse, 1);
+        if (h < 1 || w < 1) {
+            screened[i] = coarse;
+            screened[i].score = NEG_INF;
+            return;
+        }
+        PreparedTarget subTarget(vs.crop(lx, ly, h, w));
+        RefineOptions options = jointAngleOptions(vt, coarse.scale);
+        options.maxProbes = SCREEN_PROBES;
+        screened[i] = refinePeak<PoseMatchResult>(coarse.rad - angleStep, coarse.rad + angleStep, [&](float rad) {
+            return testPose(subTarget, vt, rad, coarse.scale);
+        }, options).result;
+        screened[i].x += lx;
+        screened[i].y += ly;
+    });
+    // 模板常直接取自目标图，而网格上没有恰好为 0 的角度与 1 的放缩比同时出现的位姿
+    if (poseFits(vt, 0, 1, vs.height, vs.width)) {
+        PreparedTarget target(vs);
+        screened.push_back(testPose(target, vt, 0, 1));
+    }
+    std::vector<int> order(screened.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int x, int y) { return screened[x].score > screened[y].score; });
+    order.resize(std::min<int>(order.size(), MAX_SEARCH_NUM));
+
+    // 对最好的几个候选交替细化角度与放缩比
+    std::vector<PoseMatchResult> refined(order.size());
+    pool.parallelFor(order.size(), [&](int i) {
+        const PoseMatchResult &start = screened[order[i]];
+        auto [lx, ly, h, w] = window(start, scaleRatio);
+        if (start.score == NEG_INF || h < 1 || w < 1) {
+            refined[i] = start;
+            return;
+        }
+        PreparedTarget subTarget(vs.crop(lx, ly, h, w));
+        PoseMatchResult best = testPose(subTarget, vt, start.rad, start.scale);
+        for (int round = 0; round < REFINE_ROUNDS; round++) {
+            float rad = best.rad;
+            PoseMatchResult byScale =
+                refinePeak<PoseMatchResult>(best.scale / scaleRatio, best.scale * scaleRatio,
+                                            [&](float scale) { return testPose(subTarget, vt, rad, scale); },
+                                            jointScaleOptions(vt))
+                    .result;
+            if (byScale.score > best.score) {
+                best = byScale;
+            }
+            float scale = best.scale;
+            float span = angleStep / (2 << round);
+            PoseMatchResult byAngle = refinePeak<PoseMatchResult>(best.rad - span, best.rad + span, [&](float rad) {
+                return testPose(subTarget, vt, rad, scale);
+            }, jointAngleOptions(vt, scale)).result;
+            if (byAngle.score > best.score) {
+                best = byAngle;
+            }
+        }
+        best.x += lx;
+        best.y += ly;
+        refined[i] = best;
+    });
+    // 按顺序比较，保证结果与串行一致
+    PoseMatchResult best = {NEG_INF, -1, -1, 0, 1};
+    for (const PoseMatchResult &result : refined) {
+        if (result.score > best.score) {
+            best = result;
+        }
+    }
+    // 角度规范到 [0, 2pi)
+    best.rad = std::fmod(best.rad + 2 * PI, 2 * PI);
+    return best;
+}
+
+// 同时检测旋转角度与放缩比，粗搜索在缩小 2^level 倍的图像上进行
+PoseMatchResult Match_also_orient_scale(const Image &vs, const Image &vt, int &retX, int &retY,
+                                        int level = DEFAULT_PYRAMID_LEVEL) {
+    PoseMatchResult result = searchPose(vs, vt, level);
+    if (result.score > -std::numeric_limits<double>::infinity()) {
+        retX = result.x;
+        retY = result.y;
+    }
+    fprintf(stderr, "Score=%f, Rad=%f, Scale=%f, X=%d, Y=%d\n", result.score, result.rad, result.scale, retX, retY);
+    return result;
+}
+
+PoseMatchResult Match_also_orient_scale(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY,
+                                        int level = DEFAULT_PYRAMID_LEVEL) {
+    return Match_also_orient_scale(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX,
+                                   retY, level);
+}
+
+#endif
@@ -1,8 +1,17 @@
+#ifndef _MATCH_ORIENT_CPP
+#define _MATCH_ORIENT_CPP
+
+#include <algorithm>
 #include <cmath>
+#include <memory>
+#include <tuple>
 #include <vector>
 
 #include "constants.h"
 #include "fast_match.cpp"
+#include "refine.hpp"
+#include "template_bank.hpp"
+#include "thread_pool.hpp"
 
 namespace ImageUtil {
 
@@ -15,28 +24,31 @@ uint8 bilinearInterpolation(const Image &image, float x, float y) {
     float a = x - x1;
     float b = y - y1;
 
-    return static_cast<uint8>((1 - a) * (1 - b) * image[y1][x1] + a * (1 - b) * image[y1][x2] +
-                              (1 - a) * b * image[y2][x1] + a * b * image[y2][x2]);
+    const uint8 *row1 = image.row(y1);
+    const uint8 *row2 = image.row(y2);
+    return static_cast<uint8>((1 - a) * (1 - b) * row1[x1] + a * (1 - b) * row1[x2] + (1 - a) * b * row2[x1] +
+                              a * b * row2[x2]);
 }
 
-void rotateImage(const Image &originalImage, float rad, Image &resultImage,
-                 std::vector<std::vector<bool>> &resultMask) {
+void rotateImage(const Image &originalImage, float rad, Image &resultImage, Mask &resultMask) {
+    PROFILE_SCOPE(Rotate);
     int originalHeight = originalImage.height;
     int originalWidth = originalImage.width;
     int canvasLength = 2 * std::max(originalHeight, originalWidth);
 
     // 计算旋转后图像的大小，并初始化result和mask
     Image rotatedImage(canvasLength, canvasLength);
-    std::vector<std::vector<bool>> rotatedMask(canvasLength, std::vector<bool>(canvasLength, false));
+    Mask rotatedMask(canvasLength, canvasLength);
 
     float cosRad = cos(rad);
     float sinRad = sin(rad);
     float offsetX = (canvasLength - originalHeight) / 2.0;
     float offsetY = (canvasLength - originalWidth) / 2.0;
 
-    // 旋转图像
-    for (int x = 0; x < canvasLength; x++) {
-        for (int y = 0; y < canvasLength; y++) {
+    // 旋转图像，按结果的行遍历以便连续写入
+    for (int y = 0; y < canvasLength; y++) {
+        uint8 *rotatedRow = rotatedImage.row(y);
+        for (int x = 0; x < canvasLength; x++) {
             // 反向映射坐标
             int originalX =
                 -(x - canvasLength / 2) * sinRad + (y - canvasLength / 2) * cosRad + canvasLength / 2 - offsetX;
@@ -44,177 +56,203 @@ void rotateImage(const Image &originalImage, float rad, Image &resultImage,
                 (x - canvasLength / 2) * cosRad + (y - canvasLength / 2) * sinRad + canvasLength / 2 - offsetY;
 
             if (originalY >= 0 && originalY < originalWidth && originalX >= 0 && originalX < originalHeight) {
-                rotatedImage[y][x] = bilinearInterpolation(originalImage, originalY, originalX);
-                rotatedMask[y][x] = true;
+                rotatedRow[x] = bilinearInterpolation(originalImage, originalY, originalX);
+                rotatedMask.set(y, x);
             }
         }
     }
 
     // 裁剪透明边界
-    int minX = canvasLength, minY = canvasLength, maxX = 0, maxY = 0;
-    for (int x = 0; x < canvasLength; x++) {
-        for (int y = 0; y < canvasLength; y++) {
-            if (rotatedMask[x][y]) {
-                minY = std::min(minY, y);
-                maxY = std::max(maxY, y);
-                minX = std::min(minX, x);
-                maxX = std::max(maxX, x);
-            }
-        }
+    int minX, minY, maxX, maxY;
+    if (!rotatedMask.boundingBox(minX, minY, maxX, maxY)) {
+        minX = minY = canvasLength;
+        maxX = maxY = 0;
     }
 
     // 裁剪结果
     int resultHeight = maxX - minX + 1;
     int resultWidth = maxY - minY + 1;
 
-    resultImage = Image(resultHeight, resultWidth);
-    resultMask = std::vector<std::vector<bool>>(resultHeight, std::vector<bool>(resultWidth, false));
-
-    for (int x = 0; x < resultHeight; x++) {
-        for (int y = 0; y < resultWidth; y++) {
-            resultImage[x][y] = rotatedImage[minX + x][minY + y];
-            resultMask[x][y] = rotatedMask[minX + x][minY + y];
-        }
-    }
+    resultImage = rotatedImage.crop(minX, minY, resultHeight, resultWidth).clone();
+    resultMask = rotatedMask.crop(minX, minY, resultHeight, resultWidth);
 }
 
 } // namespace ImageUtil
 
 using ImageUtil::rotateImage;
 
-MatchResult testRad(const Image &vs, const Image &vt, float rad) {
+// 旋转后的模板，以及原模板左上角在旋转结果中的位置
+struct RotatedTemplate {
+    Image image;
+    Mask mask;
+    int cornerX, cornerY;
+};
+
+RotatedTemplate rotateTemplate(const Image &vt, float rad) {
     while (rad < 0) {
         rad += 2 * PI;
     }
     while (rad > 2 * PI) {
         rad -= 2 * PI;
     }
-    Image rotatedT;
-    std::vector<std::vector<bool>> tMask;
-    rotateImage(vt, rad, rotatedT, tMask);
-    auto result = fastMatch(vs, rotatedT, tMask);
+    RotatedTemplate rotated;
+    rotateImage(vt, rad, rotated.image, rotated.mask);
+    const auto &tMask = rotated.mask;
     // 获取左上角坐标对应的位置
-    int rotatedHeight = rotatedT.height;
-    int rotatedWidth = rotatedT.width;
+    int rotatedHeight = rotated.image.height;
+    int rotatedWidth = rotated.image.width;
+    rotated.cornerX = rotated.cornerY = 0;
     if (rad < 0.5 * PI) {
-        for (int y = 0; y < rotatedWidth; y++) {
-            if (tMask[0][y]) {
-                result.y += y;
-                break;
-            }
-        }
+        rotated.cornerY = std::max(tMask.firstInRow(0), 0);
     } else if (rad < PI) {
-        for (int x = 0; x < rotatedHeight; x++) {
-            if (tMask[x][rotatedWidth - 1]) {
-                result.x += x;
-                result.y += rotatedWidth - 1;
-                break;
-            }
+        int x = tMask.firstInColumn(rotatedWidth - 1);
+        if (x >= 0) {
+            rotated.cornerX = x;
+            rotated.cornerY = rotatedWidth - 1;
         }
     } else if (rad < 1.5 * PI) {
-        for (int y = 0; y < rotatedWidth; y++) {
-            if (tMask[rotatedHeight - 1][y]) {
-                result.x += rotatedHeight - 1;
-                result.y += y;
-                break;
-            }
+        int y = tMask.firstInRow(rotatedHeight - 1);
+        if (y >= 0) {
+            rotated.cornerX = rotatedHeight - 1;
+            rotated.cornerY = y;
         }
     } else {
-        for (int x = 0; x < rotatedHeight; x++) {
-            if (tMask[x][0]) {
-                result.x += x;
-                break;
-            }
-        }
+        rotated.cornerX = std::max(tMask.firstInColumn(0), 0);
     }
+    return rotated;
+}
+
+MatchResult testRad(const PreparedTarget &vs, const Image &vt, float rad) {
+    RotatedTemplate rotated = rotateTemplate(vt, rad);
+    auto result = fastMatch(vs, rotated.image, rotated.mask);
+    result.x += rotated.cornerX;
+    result.y += rotated.cornerY;
     return result;
 }
 
-std::tuple<int, int, int, int> getSubImageRoot(int x, int y, int tHeight, int tWidth, float rad) {
-    float d = std::atan2(static_cast<float>(tHeight), static_cast<float>(tWidth)) + rad;
-    float dlen = std::sqrt(static_cast<float>(tHeight * tHeight + tWidth * tWidth)) / 2;
-    float blen = std::max(tHeight, tWidth);
-    float bx = x + dlen * std::sin(d) - blen;
-    float by = y + dlen * std::cos(d) - blen;
-    return {bx, by, bx + 2 * blen, by + 2 * blen};
+// testRad 的多目标版本，返回至多 k 个互不重叠的匹配
+std::vector<MatchResult> testRadTopK(const PreparedTarget &vs, const Image &vt, float rad, int k) {
+    RotatedTemplate rotated = rotateTemplate(vt, rad);
+    auto results = fastMatchTopK(vs, rotated.image, rotated.mask, k);
+    for (MatchResult &result : results) {
+        result.x += rotated.cornerX;
+        result.y += rotated.cornerY;
+    }
+    return results;
 }
 
-Image getSubImage(const Image &originalImage, int lx, int ly, int rx, int ry) {
-    int height = rx - lx;
-    int width = ry - ly;
-    Image resultImage(height, width);
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            resultImage[i][j] = originalImage[lx + i][ly + j];
-        }
+// 粗搜索的采样点数
+const int ORIENT_STEP_NUM = 16;
+
+float getOrientRad(int id) { return 2 * PI * id / ORIENT_STEP_NUM; }
+
+// Rotated templates of one template. The coarse sweep's templates and spectra are computed up front for one FFT
+// size; refinement angles are rotated on demand and kept, with their spectra, in a small LRU cache keyed by angle
+// and FFT size, so repeated searches with the same template skip resampling and template FFTs.
+class RotationBank {
+  public:
+    // 细化角度缓存的容量，每项在 128x128 的FFT尺寸下约占 270KB
+    static const int REFINE_CACHE_SIZE = 64;
+
+    RotationBank(const Image &vt, const Utils::Fft2D &plan)
+        : vt(vt.clone()), fftHeight(plan.height), fftWidth(plan.width), templates(ORIENT_STEP_NUM),
+          corners(ORIENT_STEP_NUM), refined(REFINE_CACHE_SIZE) {
+        ThreadPool::global().parallelFor(ORIENT_STEP_NUM, [&](int i) {
+            RotatedTemplate rotated = rotateTemplate(vt, getOrientRad(i));
+            templates[i] = std::make_unique<PreparedTemplate>(plan, rotated.image, rotated.mask);
+            corners[i] = {rotated.cornerX, rotated.cornerY};
+        });
     }
-    return resultImage;
-}
-
-std::pair<float, MatchResult> findPeek(const Image &vs, const Image &vt, float lrad, float rrad) {
-    const int TP_LIMIT = 10;
-    const float phi = (std::sqrt(5.0) - 1.0) / 2.0;
-    float x1 = rrad - phi * (rrad - lrad);
-    float x2 = lrad + phi * (rrad - lrad);
-
-    MatchResult result1 = testRad(vs, vt, x1);
-    MatchResult result2 = testRad(vs, vt, x2);
-
-    MatchResult bestResult = result1.score > result2.score ? result1 : result2;
-    float bestRad = result1.score > result2.score ? x1 : x2;
-
-    for (int i = 0; i < TP_LIMIT; ++i) {
-        if (result1.score > result2.score) {
-            rrad = x2;
-            x2 = x1;
-            result2 = result1;
-            x1 = rrad - phi * (rrad - lrad);
-            result1 = testRad(vs, vt, x1);
-        } else {
-            lrad = x1;
-            x1 = x2;
-            result1 = result2;
-            x2 = lrad + phi * (rrad - lrad);
-            result2 = testRad(vs, vt, x2);
-        }
 
-        if (result1.score > result2.score) {
-            bestResult = result1;
-            bestRad = x1;
-        } else {
-            bestResult = result2;
-            bestRad = x2;
-        }
+    // Bank for vt at the plan's FFT size, shared across searches with the same template
+    static std::shared_ptr<const RotationBank> cached(const Image &vt, const Utils::Fft2D &plan) {
+        return cachedBank<RotationBank>(vt, plan);
     }
 
-    return {bestRad, bestResult};
-}
+    const Image &templateImage() const { return vt; }
+    std::pair<int, int> fftSize() const { return {fftHeight, fftWidth}; }
 
-float Match_also_orient(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
-    Image vs(S_SIZE, S_SIZE);
-    Image vt(T_SIZE, T_SIZE);
-    std::vector tMask(T_SIZE, std::vector<bool>(T_SIZE, true));
-    for (int i = 0; i < S_SIZE; i++) {
-        for (int j = 0; j < S_SIZE; j++) {
-            vs[i][j] = s[i][j];
-        }
+    bool fits(const PreparedTarget &target) const { return templates[0]->fits(target); }
+
+    // Same as testRad(target, vt, getOrientRad(id))
+    MatchResult testCoarse(const PreparedTarget &target, int id) const {
+        auto result = fastMatch(target, *templates[id]);
+        result.x += corners[id].first;
+        result.y += corners[id].second;
+        return result;
     }
-    for (int i = 0; i < T_SIZE; i++) {
-        for (int j = 0; j < T_SIZE; j++) {
-            vt[i][j] = t[i][j];
+
+    // Same as testRadTopK(target, vt, getOrientRad(id), k)
+    std::vector<MatchResult> testCoarseTopK(const PreparedTarget &target, int id, int k) const {
+        auto results = fastMatchTopK(target, *templates[id], k);
+        for (MatchResult &result : results) {
+            result.x += corners[id].first;
+            result.y += corners[id].second;
         }
+        return results;
     }
-    // Do basic search
-    const int STEP_NUM = 16;
-    auto getRad = [&](int id) -> float { return 2 * PI * id / STEP_NUM; };
-    std::vector<MatchResult> basicResult;
-    for (int i = 0; i < STEP_NUM; i++) {
-        float rad = getRad(i);
-        auto result = testRad(vs, vt, rad);
-        basicResult.push_back(result);
-        // auto [lx, ly, rx, ry] = getSubImageRoot(basicResult[i].x, basicResult[i].y, T_SIZE, T_SIZE, getRad(i));
-        // fprintf(stderr, "rad=%f, score=%f, box=[(%d,%d),(%d,%d)]\n", rad, result.score, lx, ly, rx, ry);
+
+    // Same as testRad(target, vt, rad), for any target size
+    MatchResult testRefine(const PreparedTarget &target, float rad) const {
+        const Utils::Fft2D &plan = target.fftPlan();
+        auto entry = refined.get(rad, plan, [&](float rad) {
+            RotatedTemplate rotated = rotateTemplate(vt, rad);
+            return std::make_shared<const RefinementCache::Entry>(
+                RefinementCache::Entry{rad, plan.height, plan.width,
+                                       PreparedTemplate(plan, rotated.image, rotated.mask), rotated.cornerX,
+                                       rotated.cornerY});
+        });
+        auto result = fastMatch(target, entry->prepared);
+        result.x += entry->offsetX;
+        result.y += entry->offsetY;
+        return result;
     }
+
+  private:
+    Image vt;
+    int fftHeight, fftWidth;
+    std::vector<std::unique_ptr<PreparedTemplate>> templates;
+    std::vector<std::pair<int, int>> corners;
+    RefinementCache refined;
+};
+
+// 以旋转后模板的中心为中心、边长为模板长边两倍的子图范围 [lx, rx) x [ly, ry)，裁剪到 sHeight x sWidth 的目标图内
+std::tuple<int, int, int, int> getSubImageRoot(int x, int y, int tHeight, int tWidth, float rad, int sHeight,
+                                               int sWidth) {
+    float d = std::atan2(static_cast<float>(tHeight), static_cast<float>(tWidth)) + rad;
+    float dlen = std::sqrt(static_cast<float>(tHeight * tHeight + tWidth * tWidth)) / 2;
+    float blen = std::max(tHeight, tWidth);
+    float bx = x + dlen * std::sin(d) - blen;
+    float by = y + dlen * std::cos(d) - blen;
+    int lx = std::max<int>(bx, 0), ly = std::max<int>(by, 0);
+    int rx = std::min<int>(bx + 2 * blen, sHeight), ry = std::min<int>(by + 2 * blen, sWidth);
+    return {lx, ly, rx, ry};
+}
+
+// 返回原图的视图，不复制像素
+Image getSubImage(const Image &originalImage, int lx, int ly, int rx, int ry) {
+    return originalImage.crop(lx, ly, rx - lx, ry - ly);
+}
+
+// 在 [lrad, rrad] 内搜索得分最高的角度；给出 bank 时复用其中缓存的旋转模板。
+// 区间窄到模板外接圆上的点移动不足一个像素时停止
+std::pair<float, MatchResult> findPeekRad(const PreparedTarget &vs, const Image &vt, float lrad, float rrad,
+                                          const RotationBank *bank = nullptr) {
+    auto test = [&](float rad) { return bank != nullptr ? bank->testRefine(vs, rad) : testRad(vs, vt, rad); };
+    RefineOptions options;
+    options.tolerance = 2 / std::hypot(static_cast<float>(vt.height), static_cast<float>(vt.width));
+    RefinedPeak<MatchResult> peak = refinePeak<MatchResult>(lrad, rrad, test, options);
+    return {peak.x, peak.result};
+}
+
+// 在粗搜索（ORIENT_STEP_NUM 个角度，坐标为 vs 上的坐标）得分最高的至多两个峰附近，于以峰值位置为中心的子图中
+// 用 refinePeak（Brent 方法）细化角度，返回角度与匹配结果
+std::pair<float, MatchResult> refineOrient(const Image &vs, const Image &vt,
+                                           const std::vector<MatchResult> &basicResult,
+                                           const RotationBank *bank = nullptr) {
+    const int STEP_NUM = ORIENT_STEP_NUM;
+    auto getRad = getOrientRad;
+    ThreadPool &pool = ThreadPool::global();
     // Search around peeks
     const int MAX_SEARCH_NUM = 2;
     std::vector<int> peeks;
@@ -228,27 +266,161 @@ float Match_also_orient(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &r
     }
     std::sort(peeks.begin(), peeks.end(),
               [&](int x, int y) -> bool { return basicResult[x].score > basicResult[y].score; });
-    double bestScore = -std::numeric_limits<double>::infinity();
-    float bestRad = 0;
-    for (int i = 0; i < (int)peeks.size() && i < MAX_SEARCH_NUM; i++) {
+    const int searchNum = std::min<int>(peeks.size(), MAX_SEARCH_NUM);
+    std::vector<std::pair<float, MatchResult>> peekResults(searchNum);
+    pool.parallelFor(searchNum, [&](int i) {
         int valleyId = peeks[i];
-        auto [lx, ly, rx, ry] =
-            getSubImageRoot(basicResult[valleyId].x, basicResult[valleyId].y, T_SIZE, T_SIZE, getRad(valleyId));
-        lx = std::max(lx, 0);
-        ly = std::max(ly, 0);
-        rx = std::min(rx, S_SIZE);
-        ry = std::min(ry, S_SIZE);
-        auto subvs = getSubImage(vs, lx, ly, rx, ry);
-        auto [resultRad, result] = findPeek(subvs, vt, getRad(valleyId - 1), getRad(valleyId + 1));
-        result.x += lx;
-        result.y += ly;
-        if (result.score > bestScore) {
-            bestScore = result.score;
-            bestRad = resultRad;
-            retX = result.x;
-            retY = result.y;
+        auto [lx, ly, rx, ry] = getSubImageRoot(basicResult[valleyId].x, basicResult[valleyId].y, vt.height, vt.width,
+                                                getRad(valleyId), vs.height, vs.width);
+        PreparedTarget subTarget(getSubImage(vs, lx, ly, rx, ry));
+        peekResults[i] = findPeekRad(subTarget, vt, getRad(valleyId - 1), getRad(valleyId + 1), bank);
+        peekResults[i].second.x += lx;
+        peekResults[i].second.y += ly;
+    });
+    // 按顺序比较，保证结果与串行一致
+    std::pair<float, MatchResult> best = {0, {-std::numeric_limits<double>::infinity(), -1, -1}};
+    for (int i = 0; i < searchNum; i++) {
+        if (peekResults[i].second.score > best.second.score) {
+            best = peekResults[i];
         }
     }
-    fprintf(stderr, "Score=%f, Rad=%f, X=%d, Y=%d\n", bestScore, bestRad, retX, retY);
+    return best;
+}
+
+// 在已准备好的目标图上搜索模板的旋转角度，返回角度与匹配结果。
+// bank 与目标图的FFT尺寸一致时，粗搜索直接使用其中预先计算的频谱；细化总是使用其缓存
+std::pair<float, MatchResult> searchOrient(const Image &vs, const PreparedTarget &target, const Image &vt,
+                                           const RotationBank *bank = nullptr) {
+    // Do basic search
+    const int STEP_NUM = ORIENT_STEP_NUM;
+    auto getRad = getOrientRad;
+    const bool coarseFromBank = bank != nullptr && bank->fits(target);
+    ThreadPool &pool = ThreadPool::global();
+    std::vector<MatchResult> basicResult(STEP_NUM);
+    pool.parallelFor(STEP_NUM, [&](int i) {
+        float rad = getRad(i);
+        basicResult[i] = coarseFromBank ? bank->testCoarse(target, i) : testRad(target, vt, rad);
+        // auto [lx, ly, rx, ry] = getSubImageRoot(basicResult[i].x, basicResult[i].y, T_SIZE, T_SIZE, getRad(i));
+        // fprintf(stderr, "rad=%f, score=%f, box=[(%d,%d),(%d,%d)]\n", rad, result.score, lx, ly, rx, ry);
+    });
+    return refineOrient(vs, vt, basicResult, bank);
+}
+
+// 原模板左上角位于 (x, y)、旋转 rad 后模板中心的位置
+std::pair<float, float> rotatedCentre(int x, int y, int tHeight, int tWidth, float rad) {
+    float d = std::atan2(static_cast<float>(tHeight), static_cast<float>(tWidth)) + rad;
+    float dlen = std::sqrt(static_cast<float>(tHeight * tHeight + tWidth * tWidth)) / 2;
+    return {x + dlen * std::sin(d), y + dlen * std::cos(d)};
+}
+
+// Up to k non-overlapping instances of vt scoring at least threshold, best first, as (angle, result) pairs. Every
+// coarse angle contributes its own top k placements; these are pooled across angles, merging only peaks whose
+// centres nearly coincide, and the best 2k are refined in the sub-window around each as refineOrient refines a
+// peak. The refined results are suppressed again, now treating instances whose centres are closer than the
+// template's shorter side as overlapping.
+std::vector<std::pair<float, MatchResult>> searchOrientTopK(const Image &vs, const PreparedTarget &target,
+                                                            const Image &vt, int k, double threshold,
+                                                            const RotationBank *bank = nullptr) {
+    using Peak = std::pair<float, MatchResult>;
+    // 细化的候选数为 k 的倍数
+    const int COARSE_CANDIDATE_FACTOR = 2;
+    const int STEP_NUM = ORIENT_STEP_NUM;
+    auto getRad = getOrientRad;
+    const bool coarseFromBank = bank != nullptr && bank->fits(target);
+    ThreadPool &pool = ThreadPool::global();
+    std::vector<std::vector<MatchResult>> basicResults(STEP_NUM);
+    pool.parallelFor(STEP_NUM, [&](int i) {
+        basicResults[i] = coarseFromBank ? bank->testCoarseTopK(target, i, k) : testRadTopK(target, vt, getRad(i), k);
+    });
+    auto score = [](const Peak &peak) { return peak.second.score; };
+    auto closerThan = [&](float distance) {
+        return [&vt, distance](const Peak &a, const Peak &b) {
+            auto [ax, ay] = rotatedCentre(a.second.x, a.second.y, vt.height, vt.width, a.first);
+            auto [bx, by] = rotatedCentre(b.second.x, b.second.y, vt.height, vt.width, b.first);
+            return std::hypot(ax - bx, ay - by) < distance;
+        };
+    };
+    const float minDistance = std::min(vt.height, vt.width);
+    // 粗搜索的得分不准，只合并中心几乎重合的候选（同一实例在相邻角度上的峰），以免强的误匹配压掉相邻的真实例
+    auto candidates = makePeakHeap<Peak>(COARSE_CANDIDATE_FACTOR * k, score, closerThan(minDistance / 2));
+    for (int i = 0; i < STEP_NUM; i++) {
+        for (const MatchResult &result : basicResults[i]) {
+            if (candidates.accepts(result.score)) {
+                candidates.push({getRad(i), result});
+            }
+        }
+    }
+    std::vector<Peak> coarse = candidates.sorted();
+    std::vector<Peak> refined(coarse.size());
+    pool.parallelFor(coarse.size(), [&](int i) {
+        auto [rad, result] = coarse[i];
+        auto [lx, ly, rx, ry] = getSubImageRoot(result.x, result.y, vt.height, vt.width, rad, vs.height, vs.width);
+        PreparedTarget subTarget(getSubImage(vs, lx, ly, rx, ry));
+        refined[i] = findPeekRad(subTarget, vt, rad - getRad(1), rad + getRad(1), bank);
+        refined[i].second.x += lx;
+        refined[i].second.y += ly;
+    });
+    // 细化后的得分可以比较，按模板大小做抑制；按候选顺序加入，保证结果与串行一致
+    auto peaks = makePeakHeap<Peak>(k, score, closerThan(minDistance));
+    for (const Peak &peak : refined) {
+        if (peak.second.score >= threshold && peaks.accepts(peak.second.score)) {
+            peaks.push(peak);
+        }
+    }
+    return peaks.sorted();
+}
+
+float Match_also_orient(const Image &vs, const Image &vt, int &retX, int &retY) {
+    PreparedTarget target(vs);
+    // 同一模板的旋转版本与频谱在多次调用间复用
+    auto bank = RotationBank::cached(vt, target.fftPlan());
+    auto [bestRad, result] = searchOrient(vs, target, vt, bank.get());
+    if (result.score > -std::numeric_limits<double>::infinity()) {
+        retX = result.x;
+        retY = result.y;
+    }
+    fprintf(stderr, "Score=%f, Rad=%f, X=%d, Y=%d\n", result.score, bestRad, retX, retY);
     return bestRad;
-}
\ No newline at end of file
+}
+
+float Match_also_orient(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
+    // 直接引用调用者的数组，不复制像素
+    return Match_also_orient(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX, retY);
+}
+
+// 检测目标图中模板的多个实例（可能各自旋转），按得分从高到低返回至多 k 个得分不低于 threshold 的角度与位置
+std::vector<std::pair<float, MatchResult>> Match_also_orient_topk(const Image &vs, const Image &vt, int k,
+                                                                  double threshold = scoreThreshold()) {
+    PreparedTarget target(vs);
+    auto bank = RotationBank::cached(vt, target.fftPlan());
+    auto results = searchOrientTopK(vs, target, vt, k, threshold, bank.get());
+    for (const auto &[rad, result] : results) {
+        fprintf(stderr, "Score=%f, Rad=%f, X=%d, Y=%d\n", result.score, rad, result.x, result.y);
+    }
+    return results;
+}
+
+std::vector<std::pair<float, MatchResult>> Match_also_orient_topk(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE],
+                                                                  int k, double threshold = scoreThreshold()) {
+    return Match_also_orient_topk(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), k,
+                                  threshold);
+}
+
+// 同一目标图上匹配 n 个模板，目标图的频谱只计算一次，各模板在线程池中并行搜索
+std::vector<std::pair<float, MatchResult>> Match_also_orient_batch(uint8 s[S_SIZE][S_SIZE], uint8 t[][T_SIZE][T_SIZE],
+                                                                   int n) {
+    Image vs = Image::view(&s[0][0], S_SIZE, S_SIZE);
+    PreparedTarget target(vs);
+    std::vector<std::pair<float, MatchResult>> results(n);
+    ThreadPool::global().parallelFor(n, [&](int k) {
+        Image vt = Image::view(&t[k][0][0], T_SIZE, T_SIZE);
+        results[k] = searchOrient(vs, target, vt, RotationBank::cached(vt, target.fftPlan()).get());
+    });
+    for (int k = 0; k < n; k++) {
+        fprintf(stderr, "Template=%d, Score=%f, Rad=%f, X=%d, Y=%d\n", k, results[k].second.score, results[k].first,
+                results[k].second.x, results[k].second.y);
+    }
+    return results;
+}
+
+#endif
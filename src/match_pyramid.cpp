@@ -0,0 +1,153 @@
+#ifndef _MATCH_PYRAMID_CPP
+#define _MATCH_PYRAMID_CPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "constants.h"
+#include "fast_match.cpp"
+#include "match_orient.cpp"
+#include "match_scale.cpp"
+#include "thread_pool.hpp"
+
+namespace ImageUtil {
+
+// 按 factor x factor 的块取平均缩小图像，不足一块的边缘舍去
+Image downsample(const Image &image, int factor) {
+    PROFILE_SCOPE(Downsample);
+    Image result(image.height / factor, image.width / factor);
+    const int area = factor * factor;
+    std::vector<int> sums(result.width);
+    for (int i = 0; i < result.height; i++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int k = 0; k < factor; k++) {
+            const uint8 *src = image.row(i * factor + k);
+            for (int j = 0; j < result.width * factor; j++) {
+                sums[j / factor] += src[j];
+            }
+        }
+        uint8 *dst = result.row(i);
+        for (int j = 0; j < result.width; j++) {
+            dst[j] = (sums[j] + area / 2) / area;
+        }
+    }
+    return result;
+}
+
+} // namespace ImageUtil
+
+// Coarse-to-fine orientation search. The coarse sweep runs on target and template downsampled by 2^level, which
+// shrinks the transforms by 4^level; each peak is then refined at full resolution inside the sub-window around
+// it, exactly as searchOrient refines its own peaks. level 0 is searchOrient itself.
+std::pair<float, MatchResult> searchOrientPyramid(const Image &vs, const Image &vt, int level) {
+    const int factor = 1 << level;
+    if (level <= 0 || vt.height / factor < 2 || vt.width / factor < 2) {
+        PreparedTarget target(vs);
+        return searchOrient(vs, target, vt);
+    }
+    Image lowT = ImageUtil::downsample(vt, factor);
+    PreparedTarget lowTarget(ImageUtil::downsample(vs, factor));
+    std::vector<MatchResult> basicResult(ORIENT_STEP_NUM);
+    ThreadPool::global().parallelFor(ORIENT_STEP_NUM, [&](int i) {
+        basicResult[i] = testRad(lowTarget, lowT, getOrientRad(i));
+        // 换算回原图坐标
+        basicResult[i].x *= factor;
+        basicResult[i].y *= factor;
+    });
+    return refineOrient(vs, vt, basicResult);
+}
+
+// Coarse-to-fine scale search. The coarse sweep runs at 2^level times lower resolution; the level is lowered until
+// the smallest coarse template still has MIN_COARSE_SIZE pixels on its shorter side there. Each valley is refined
+// at full resolution in the getScaleWindow window around it, widened for the position error of the coarse level,
+// or in the whole target when that window does not fit, as searchScale does.
+std::pair<float, MatchResult> searchScalePyramid(const Image &vs, const Image &vt, int level) {
+    // 粗层上最小放缩模板的短边不少于该像素数，否则粗搜索失准
+    const int MIN_COARSE_SIZE = 8;
+    // 放缩比范围按原图尺寸确定，与 searchScale 一致
+    const ScaleRange range = ScaleRange::of(vs.height, vs.width, vt.height, vt.width);
+    int factor = 1 << std::max(level, 0);
+    while (factor > 1 && std::min(vt.height, vt.width) * range.minScale < MIN_COARSE_SIZE * factor) {
+        factor /= 2;
+    }
+    if (factor == 1) {
+        PreparedTarget target(vs);
+        return searchScale(vs, target, vt);
+    }
+    auto getScale = [&](int id) { return getCoarseScale(id, range); };
+    Image lowT = ImageUtil::downsample(vt, factor);
+    PreparedTarget lowTarget(ImageUtil::downsample(vs, factor));
+    ThreadPool &pool = ThreadPool::global();
+    std::vector<MatchResult> basicResult(SCALE_STEP_NUM);
+    std::vector<double> basicScores(SCALE_STEP_NUM);
+    pool.parallelFor(SCALE_STEP_NUM, [&](int i) {
+        basicResult[i] = testScale(lowTarget, lowT, getScale(i));
+        basicScores[i] = basicResult[i].score;
+    });
+    std::vector<int> valleys = findScaleValleys(basicScores);
+    const int searchNum = valleys.size();
+    std::vector<std::pair<float, MatchResult>> valleyResults(searchNum);
+    pool.parallelFor(searchNum, [&](int i) {
+        int valleyId = valleys[i];
+        float lsr = getScale(valleyId - 1), rsr = getScale(valleyId + 1);
+        int lx, ly, rx, ry;
+        // 粗层的位置误差约为 factor 个像素
+        if (!getScaleWindow(basicResult[valleyId].x * factor, basicResult[valleyId].y * factor, vt.height, vt.width,
+                            getScale(valleyId), rsr, vs.height, vs.width, lx, ly, rx, ry, 2 * factor)) {
+            PreparedTarget target(vs);
+            valleyResults[i] = findPeekScale(target, vt, lsr, rsr);
+            return;
+        }
+        PreparedTarget subTarget(vs.crop(lx, ly, rx - lx, ry - ly));
+        valleyResults[i] = findPeekScale(subTarget, vt, lsr, rsr);
+        valleyResults[i].second.x += lx;
+        valleyResults[i].second.y += ly;
+    });
+    // 按顺序比较，保证结果与串行一致
+    std::pair<float, MatchResult> best = {0, {-std::numeric_limits<double>::infinity(), -1, -1}};
+    for (int i = 0; i < searchNum; i++) {
+        if (valleyResults[i].second.score > best.second.score) {
+            best = valleyResults[i];
+        }
+    }
+    return best;
+}
+
+// Match_also_orient 的金字塔版本，粗搜索在缩小 2^level 倍的图像上进行
+float Match_also_orient_pyramid(const Image &vs, const Image &vt, int &retX, int &retY,
+                                int level = DEFAULT_PYRAMID_LEVEL) {
+    auto [bestRad, result] = searchOrientPyramid(vs, vt, level);
+    if (result.score > -std::numeric_limits<double>::infinity()) {
+        retX = result.x;
+        retY = result.y;
+    }
+    fprintf(stderr, "Score=%f, Rad=%f, X=%d, Y=%d\n", result.score, bestRad, retX, retY);
+    return bestRad;
+}
+
+float Match_also_orient_pyramid(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY,
+                                int level = DEFAULT_PYRAMID_LEVEL) {
+    return Match_also_orient_pyramid(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX,
+                                     retY, level);
+}
+
+// Match_also_scale 的金字塔版本，粗搜索在缩小 2^level 倍的图像上进行
+float Match_also_scale_pyramid(const Image &vs, const Image &vt, int &retX, int &retY,
+                               int level = DEFAULT_PYRAMID_LEVEL) {
+    auto [bestScale, result] = searchScalePyramid(vs, vt, level);
+    if (result.score > -std::numeric_limits<double>::infinity()) {
+        retX = result.x;
+        retY = result.y;
+    }
+    fprintf(stderr, "Score=%f, Scale=%f, X=%d, Y=%d\n", result.score, bestScale, retX, retY);
+    return bestScale;
+}
+
+float Match_also_scale_pyramid(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY,
+                               int level = DEFAULT_PYRAMID_LEVEL) {
+    return Match_also_scale_pyramid(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX,
+                                    retY, level);
+}
+
+#endif
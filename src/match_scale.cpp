@@ -1,12 +1,22 @@
+#ifndef _MATCH_SCALE_CPP
+#define _MATCH_SCALE_CPP
+
+#include <algorithm>
 #include <cmath>
+#include <memory>
+#include <tuple>
 #include <vector>
 
 #include "constants.h"
 #include "fast_match.cpp"
+#include "refine.hpp"
+#include "template_bank.hpp"
+#include "thread_pool.hpp"
 
 namespace ImageUtil {
 
 void scaleImage(const Image &originalImage, float scale, Image &resultImage) {
+    PROFILE_SCOPE(Scale);
     int originalHeight = originalImage.height;
     int originalWidth = originalImage.width;
 
@@ -14,15 +24,17 @@ void scaleImage(const Image &originalImage, float scale, Image &resultImage) {
     int newWidth = static_cast<int>(originalWidth * scale);
     resultImage = Image(newHeight, newWidth);
 
+    // 列映射对每一行都相同，预先算好
+    std::vector<int> origCols(newWidth);
+    for (int j = 0; j < newWidth; ++j) {
+        origCols[j] = std::min(static_cast<int>(j / scale), originalWidth - 1);
+    }
     for (int i = 0; i < newHeight; ++i) {
+        int orig_i = std::min(static_cast<int>(i / scale), originalHeight - 1);
+        const uint8 *src = originalImage.row(orig_i);
+        uint8 *dst = resultImage.row(i);
         for (int j = 0; j < newWidth; ++j) {
-            int orig_i = static_cast<int>(i / scale);
-            int orig_j = static_cast<int>(j / scale);
-
-            orig_i = std::min(orig_i, originalHeight - 1);
-            orig_j = std::min(orig_j, originalWidth - 1);
-
-            resultImage[i][j] = originalImage[orig_i][orig_j];
+            dst[j] = src[origCols[j]];
         }
     }
 }
@@ -31,80 +43,127 @@ void scaleImage(const Image &originalImage, float scale, Image &resultImage) {
 
 using ImageUtil::scaleImage;
 
-MatchResult testScale(const Image &vs, const Image &vt, float scale) {
+MatchResult testScale(const PreparedTarget &vs, const Image &vt, float scale) {
     Image scaledT;
     scaleImage(vt, scale, scaledT);
-    std::vector tMask(scaledT.height, std::vector<bool>(scaledT.width, true));
-    return fastMatch(vs, scaledT, tMask);
+    return fastMatch(vs, scaledT);
 }
 
-std::pair<float, MatchResult> findPeek(const Image &vs, const Image &vt, float lsr, float rsr) {
-    const int TP_LIMIT = 10;
-    const float phi = (std::sqrt(5.0) - 1.0) / 2.0;
-    float x1 = rsr - phi * (rsr - lsr);
-    float x2 = lsr + phi * (rsr - lsr);
-
-    MatchResult result1 = testScale(vs, vt, x1);
-    MatchResult result2 = testScale(vs, vt, x2);
-
-    MatchResult bestResult = result1.score > result2.score ? result1 : result2;
-    float bestScale = result1.score > result2.score ? x1 : x2;
-
-    for (int i = 0; i < TP_LIMIT; ++i) {
-        if (result1.score > result2.score) {
-            rsr = x2;
-            x2 = x1;
-            result2 = result1;
-            x1 = rsr - phi * (rsr - lsr);
-            result1 = testScale(vs, vt, x1);
-        } else {
-            lsr = x1;
-            x1 = x2;
-            result1 = result2;
-            x2 = lsr + phi * (rsr - lsr);
-            result2 = testScale(vs, vt, x2);
-        }
+// testScale 的多目标版本，返回至多 k 个互不重叠的匹配
+std::vector<MatchResult> testScaleTopK(const PreparedTarget &vs, const Image &vt, float scale, int k) {
+    Image scaledT;
+    scaleImage(vt, scale, scaledT);
+    return fastMatchTopK(vs, scaledT, k);
+}
 
-        if (result1.score > result2.score) {
-            bestResult = result1;
-            bestScale = x1;
-        } else {
-            bestResult = result2;
-            bestScale = x2;
-        }
+// 粗搜索的采样点数
+const int SCALE_STEP_NUM = 8;
+
+// Range of scale factors searched for a template in a target: from the scale at which the template's longer side
+// is 16 pixels up to the largest at which it still fits in the target.
+struct ScaleRange {
+    float minScale, maxScale;
+
+    static ScaleRange of(int sHeight, int sWidth, int tHeight, int tWidth) {
+        float maxScale = std::min((float)sHeight / tHeight, (float)sWidth / tWidth);
+        return {std::min((float)16 / std::max(tHeight, tWidth), maxScale), maxScale};
     }
 
-    return {bestScale, bestResult};
-}
+    static ScaleRange of(const PreparedTarget &target, const Image &vt) {
+        return of(target.height, target.width, vt.height, vt.width);
+    }
 
-float Match_also_scale(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
-    Image vs(S_SIZE, S_SIZE);
-    Image vt(T_SIZE, T_SIZE);
-    std::vector tMask(T_SIZE, std::vector<bool>(T_SIZE, true));
-    for (int i = 0; i < S_SIZE; i++) {
-        for (int j = 0; j < S_SIZE; j++) {
-            vs[i][j] = s[i][j];
-        }
+    // 共 stepNum 个按等比分布的采样点中的第 id 个
+    float at(int id, int stepNum) const {
+        return minScale * pow(maxScale / minScale, static_cast<float>(id) / (stepNum - 1));
     }
-    for (int i = 0; i < T_SIZE; i++) {
-        for (int j = 0; j < T_SIZE; j++) {
-            vt[i][j] = t[i][j];
-        }
+
+    bool operator==(const ScaleRange &other) const {
+        return minScale == other.minScale && maxScale == other.maxScale;
     }
-    // Do basic search
-    const int STEP_NUM = 8;
-    const float MAX_SCALE = (float)S_SIZE / T_SIZE;
-    const float MIN_SCALE = (float)16 / T_SIZE;
-    auto getScale = [&](int id) -> float {
-        return MIN_SCALE * pow(MAX_SCALE / MIN_SCALE, static_cast<float>(id) / (STEP_NUM - 1));
-    };
-    std::vector<double> basicScores;
-    for (int i = 0; i < STEP_NUM; i++) {
-        auto result = testScale(vs, vt, getScale(i));
-        basicScores.push_back(result.score);
-        // fprintf(stderr, "scale=%f, score=%f\n", getScale(i), result.score);
+};
+
+float getCoarseScale(int id, const ScaleRange &range) { return range.at(id, SCALE_STEP_NUM); }
+
+// Scaled templates of one template. The coarse sweep's templates, with their energies and spectra, are computed
+// up front for one FFT size and scale range; refinement scales are memoised in a small LRU cache keyed by scale and
+// FFT size. A bank stays valid for every target with that FFT size and range until the template changes.
+class ScaleBank {
+  public:
+    // 细化放缩比缓存的容量
+    static const int REFINE_CACHE_SIZE = 64;
+
+    ScaleBank(const Image &vt, const Utils::Fft2D &plan, const ScaleRange &range)
+        : vt(vt.clone()), fftHeight(plan.height), fftWidth(plan.width), range(range), templates(SCALE_STEP_NUM),
+          refined(REFINE_CACHE_SIZE) {
+        ThreadPool::global().parallelFor(SCALE_STEP_NUM, [&](int i) {
+            Image scaledT;
+            scaleImage(vt, getCoarseScale(i, range), scaledT);
+            templates[i] = std::make_unique<PreparedTemplate>(plan, scaledT);
+        });
     }
-    // Search around valleys
+
+    // Bank for vt at the plan's FFT size and the given range, shared across searches with the same template
+    static std::shared_ptr<const ScaleBank> cached(const Image &vt, const Utils::Fft2D &plan,
+                                                   const ScaleRange &range) {
+        return cachedBank<ScaleBank>(vt, plan, range);
+    }
+
+    const Image &templateImage() const { return vt; }
+    std::pair<int, int> fftSize() const { return {fftHeight, fftWidth}; }
+    std::tuple<const ScaleRange &> params() const { return std::tie(range); }
+
+    // 粗搜索的频谱能否直接用于 target：FFT 尺寸与放缩比范围都需一致
+    bool fits(const PreparedTarget &target) const {
+        return templates[0]->fits(target) && ScaleRange::of(target, vt) == range;
+    }
+
+    // Same as testScale(target, vt, getCoarseScale(id, range))
+    MatchResult testCoarse(const PreparedTarget &target, int id) const { return fastMatch(target, *templates[id]); }
+
+    // Same as testScaleTopK(target, vt, getCoarseScale(id, range), k)
+    std::vector<MatchResult> testCoarseTopK(const PreparedTarget &target, int id, int k) const {
+        return fastMatchTopK(target, *templates[id], k);
+    }
+
+    // Same as testScale(target, vt, scale), for any target size
+    MatchResult testRefine(const PreparedTarget &target, float scale) const {
+        const Utils::Fft2D &plan = target.fftPlan();
+        auto entry = refined.get(scale, plan, [&](float scale) {
+            Image scaledT;
+            scaleImage(vt, scale, scaledT);
+            return std::make_shared<const RefinementCache::Entry>(
+                RefinementCache::Entry{scale, plan.height, plan.width, PreparedTemplate(plan, scaledT), 0, 0});
+        });
+        return fastMatch(target, entry->prepared);
+    }
+
+  private:
+    Image vt;
+    int fftHeight, fftWidth;
+    ScaleRange range;
+    std::vector<std::unique_ptr<PreparedTemplate>> templates;
+    RefinementCache refined;
+};
+
+// 在 [lsr, rsr] 内搜索得分最高的放缩比；给出 bank 时复用其中缓存的放缩模板。
+// 区间窄到模板长边的长度变化不足一个像素时停止
+std::pair<float, MatchResult> findPeekScale(const PreparedTarget &vs, const Image &vt, float lsr, float rsr,
+                                            const ScaleBank *bank = nullptr) {
+    auto test = [&](float scale) {
+        return bank != nullptr ? bank->testRefine(vs, scale) : testScale(vs, vt, scale);
+    };
+    RefineOptions options;
+    options.tolerance = 1.0f / std::max(vt.height, vt.width);
+    // 最近邻放缩使得分随放缩比呈阶梯状，抛物线顶点不可靠，只做黄金分割步
+    options.parabolic = false;
+    RefinedPeak<MatchResult> peak = refinePeak<MatchResult>(lsr, rsr, test, options);
+    return {peak.x, peak.result};
+}
+
+// 粗搜索得分中的“谷底”（得分的局部极大值），按得分从高到低取至多两个
+std::vector<int> findScaleValleys(const std::vector<double> &basicScores) {
+    const int STEP_NUM = SCALE_STEP_NUM;
     const int MAX_SEARCH_NUM = 2;
     std::vector<int> valleys;
     for (int i = 1; i < STEP_NUM - 1; i++) {
@@ -116,18 +175,201 @@ float Match_also_scale(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &re
         }
     }
     std::sort(valleys.begin(), valleys.end(), [&](int x, int y) -> bool { return basicScores[x] > basicScores[y]; });
-    double bestScore = -std::numeric_limits<double>::infinity();
-    float bestScale = 0;
-    for (int i = 0; i < (int)valleys.size() && i < MAX_SEARCH_NUM; i++) {
+    valleys.resize(std::min<int>(valleys.size(), MAX_SEARCH_NUM));
+    return valleys;
+}
+
+// Window [lx, rx) x [ly, ry) of an sHeight x sWidth target for refining a coarse match at (x, y) with the template
+// scaled by `scale`, when the refined scale may be as large as maxScale. The window is centred on the coarse
+// template's centre and holds the template at maxScale with a margin for the centre moving as the scale changes,
+// widened by `slack` pixels when the coarse position itself is that uncertain. Returns false when the window,
+// clipped to the target, cannot hold that template or covers most of the target; the refinement should then use the
+// whole target.
+bool getScaleWindow(int x, int y, int tHeight, int tWidth, float scale, float maxScale, int sHeight, int sWidth,
+                    int &lx, int &ly, int &rx, int &ry, int slack = 0) {
+    const float margin = std::max(tHeight, tWidth) * maxScale / 8 + 2 + slack;
+    const float cx = x + tHeight * scale / 2, cy = y + tWidth * scale / 2;
+    const float halfHeight = tHeight * maxScale / 2 + margin, halfWidth = tWidth * maxScale / 2 + margin;
+    lx = std::max<int>(cx - halfHeight, 0);
+    ly = std::max<int>(cy - halfWidth, 0);
+    rx = std::min<int>(std::ceil(cx + halfHeight), sHeight);
+    ry = std::min<int>(std::ceil(cy + halfWidth), sWidth);
+    // 贴近边界时窗口被截短，放不下最大的模板；窗口超过目标图一半时裁剪也没有收益
+    const bool fitsTemplate = rx - lx >= tHeight * maxScale && ry - ly >= tWidth * maxScale;
+    return fitsTemplate && 2 * static_cast<int64>(rx - lx) * (ry - ly) <= static_cast<int64>(sHeight) * sWidth;
+}
+
+// 在已准备好的目标图上搜索模板的放缩比，返回放缩比与匹配结果。vs 为 target 对应的图像，细化在粗搜索峰值附近的
+// 子图中进行。放缩比范围由目标图与模板的尺寸决定。bank 与目标图的FFT尺寸、放缩比范围一致时，粗搜索直接使用其中
+// 预先计算的频谱；细化总是使用其缓存
+std::pair<float, MatchResult> searchScale(const Image &vs, const PreparedTarget &target, const Image &vt,
+                                          const ScaleBank *bank = nullptr) {
+    // Do basic search
+    const int STEP_NUM = SCALE_STEP_NUM;
+    const ScaleRange range = ScaleRange::of(target, vt);
+    auto getScale = [&](int id) { return getCoarseScale(id, range); };
+    const bool coarseFromBank = bank != nullptr && bank->fits(target);
+    ThreadPool &pool = ThreadPool::global();
+    std::vector<MatchResult> basicResult(STEP_NUM);
+    std::vector<double> basicScores(STEP_NUM);
+    pool.parallelFor(STEP_NUM, [&](int i) {
+        basicResult[i] = coarseFromBank ? bank->testCoarse(target, i) : testScale(target, vt, getScale(i));
+        basicScores[i] = basicResult[i].score;
+    });
+    // Search around valleys
+    std::vector<int> valleys = findScaleValleys(basicScores);
+    const int searchNum = valleys.size();
+    std::vector<std::pair<float, MatchResult>> valleyResults(searchNum);
+    pool.parallelFor(searchNum, [&](int i) {
         int valleyId = valleys[i];
-        auto [resultScale, result] = findPeek(vs, vt, getScale(valleyId - 1), getScale(valleyId + 1));
-        if (result.score > bestScore) {
-            bestScore = result.score;
-            bestScale = resultScale;
-            retX = result.x;
-            retY = result.y;
+        float lsr = getScale(valleyId - 1), rsr = getScale(valleyId + 1);
+        int lx, ly, rx, ry;
+        if (!getScaleWindow(basicResult[valleyId].x, basicResult[valleyId].y, vt.height, vt.width, getScale(valleyId),
+                            rsr, vs.height, vs.width, lx, ly, rx, ry)) {
+            valleyResults[i] = findPeekScale(target, vt, lsr, rsr, bank);
+            return;
+        }
+        PreparedTarget subTarget(vs.crop(lx, ly, rx - lx, ry - ly));
+        valleyResults[i] = findPeekScale(subTarget, vt, lsr, rsr, bank);
+        valleyResults[i].second.x += lx;
+        valleyResults[i].second.y += ly;
+    });
+    // 按顺序比较，保证结果与串行一致
+    std::pair<float, MatchResult> best = {0, {-std::numeric_limits<double>::infinity(), -1, -1}};
+    for (int i = 0; i < searchNum; i++) {
+        if (valleyResults[i].second.score > best.second.score) {
+            best = valleyResults[i];
+        }
+    }
+    return best;
+}
+
+// Up to k non-overlapping instances of vt scoring at least threshold, best first, as (scale, result) pairs. Every
+// coarse scale contributes its own top k placements; these are pooled across scales, merging only peaks whose
+// centres nearly coincide, and the best 2k are refined between the neighbouring coarse scales in the
+// getScaleWindow window, grown inward to hold the largest of those templates when clipped at a border. The refined
+// results are suppressed again, now treating instances whose scaled template rectangles intersect as overlapping.
+std::vector<std::pair<float, MatchResult>> searchScaleTopK(const Image &vs, const PreparedTarget &target,
+                                                           const Image &vt, int k, double threshold,
+                                                           const ScaleBank *bank = nullptr) {
+    using Peak = std::pair<float, MatchResult>;
+    // 细化的候选数为 k 的倍数
+    const int COARSE_CANDIDATE_FACTOR = 2;
+    const int STEP_NUM = SCALE_STEP_NUM;
+    const ScaleRange range = ScaleRange::of(target, vt);
+    auto getScale = [&](int id) { return getCoarseScale(id, range); };
+    const bool coarseFromBank = bank != nullptr && bank->fits(target);
+    ThreadPool &pool = ThreadPool::global();
+    std::vector<std::vector<MatchResult>> basicResults(STEP_NUM);
+    pool.parallelFor(STEP_NUM, [&](int i) {
+        basicResults[i] =
+            coarseFromBank ? bank->testCoarseTopK(target, i, k) : testScaleTopK(target, vt, getScale(i), k);
+    });
+    auto score = [](const Peak &peak) { return peak.second.score; };
+    // 粗搜索的得分不准，只合并中心距离小于较小模板短边一半的候选，以免强的误匹配压掉相邻的真实例
+    auto nearCentre = [&](const Peak &a, const Peak &b) {
+        float ax = a.second.x + vt.height * a.first / 2, ay = a.second.y + vt.width * a.first / 2;
+        float bx = b.second.x + vt.height * b.first / 2, by = b.second.y + vt.width * b.first / 2;
+        return std::hypot(ax - bx, ay - by) < std::min(vt.height, vt.width) * std::min(a.first, b.first) / 2;
+    };
+    auto overlap = [&](const Peak &a, const Peak &b) {
+        int ah = vt.height * a.first, aw = vt.width * a.first;
+        int bh = vt.height * b.first, bw = vt.width * b.first;
+        return a.second.x < b.second.x + bh && b.second.x < a.second.x + ah && a.second.y < b.second.y + bw &&
+               b.second.y < a.second.y + aw;
+    };
+    auto candidates = makePeakHeap<Peak>(COARSE_CANDIDATE_FACTOR * k, score, nearCentre);
+    for (int i = 0; i < STEP_NUM; i++) {
+        for (const MatchResult &result : basicResults[i]) {
+            if (candidates.accepts(result.score)) {
+                candidates.push({getScale(i), result});
+            }
+        }
+    }
+    std::vector<Peak> coarse = candidates.sorted();
+    const float ratio = getScale(1) / getScale(0);
+    std::vector<Peak> refined(coarse.size());
+    pool.parallelFor(coarse.size(), [&](int i) {
+        auto [scale, result] = coarse[i];
+        float lsr = std::max(scale / ratio, range.minScale), rsr = std::min(scale * ratio, range.maxScale);
+        int lx, ly, rx, ry;
+        if (!getScaleWindow(result.x, result.y, vt.height, vt.width, scale, rsr, vs.height, vs.width, lx, ly, rx,
+                            ry)) {
+            // 与 searchScale 不同，不退回整幅原图，否则细化可能跳到另一个实例上：贴近边界时把截短的窗口向内扩展到
+            // 能放下按 rsr 放缩的模板；窗口过大时照常裁剪
+            const int needHeight = std::ceil(vt.height * rsr), needWidth = std::ceil(vt.width * rsr);
+            lx = std::max(std::min(lx, rx - needHeight), 0);
+            rx = std::min(std::max(rx, lx + needHeight), vs.height);
+            ly = std::max(std::min(ly, ry - needWidth), 0);
+            ry = std::min(std::max(ry, ly + needWidth), vs.width);
+        }
+        PreparedTarget subTarget(vs.crop(lx, ly, rx - lx, ry - ly));
+        refined[i] = findPeekScale(subTarget, vt, lsr, rsr, bank);
+        refined[i].second.x += lx;
+        refined[i].second.y += ly;
+    });
+    // 细化后的得分可以比较，按模板矩形做抑制；按候选顺序加入，保证结果与串行一致
+    auto peaks = makePeakHeap<Peak>(k, score, overlap);
+    for (const Peak &peak : refined) {
+        if (peak.second.score >= threshold && peaks.accepts(peak.second.score)) {
+            peaks.push(peak);
         }
     }
-    fprintf(stderr, "Score=%f, Scale=%f, X=%d, Y=%d\n", bestScore, bestScale, retX, retY);
+    return peaks.sorted();
+}
+
+float Match_also_scale(const Image &vs, const Image &vt, int &retX, int &retY) {
+    PreparedTarget target(vs);
+    // 同一模板的放缩版本与频谱在多次调用间复用
+    auto bank = ScaleBank::cached(vt, target.fftPlan(), ScaleRange::of(target, vt));
+    auto [bestScale, result] = searchScale(vs, target, vt, bank.get());
+    if (result.score > -std::numeric_limits<double>::infinity()) {
+        retX = result.x;
+        retY = result.y;
+    }
+    fprintf(stderr, "Score=%f, Scale=%f, X=%d, Y=%d\n", result.score, bestScale, retX, retY);
     return bestScale;
-}
\ No newline at end of file
+}
+
+float Match_also_scale(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE], int &retX, int &retY) {
+    // 直接引用调用者的数组，不复制像素
+    return Match_also_scale(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), retX, retY);
+}
+
+// 检测目标图中模板的多个实例（可能各自放缩），按得分从高到低返回至多 k 个得分不低于 threshold 的放缩比与位置
+std::vector<std::pair<float, MatchResult>> Match_also_scale_topk(const Image &vs, const Image &vt, int k,
+                                                                 double threshold = scoreThreshold()) {
+    PreparedTarget target(vs);
+    auto bank = ScaleBank::cached(vt, target.fftPlan(), ScaleRange::of(target, vt));
+    auto results = searchScaleTopK(vs, target, vt, k, threshold, bank.get());
+    for (const auto &[scale, result] : results) {
+        fprintf(stderr, "Score=%f, Scale=%f, X=%d, Y=%d\n", result.score, scale, result.x, result.y);
+    }
+    return results;
+}
+
+std::vector<std::pair<float, MatchResult>> Match_also_scale_topk(uint8 s[S_SIZE][S_SIZE], uint8 t[T_SIZE][T_SIZE],
+                                                                 int k, double threshold = scoreThreshold()) {
+    return Match_also_scale_topk(Image::view(&s[0][0], S_SIZE, S_SIZE), Image::view(&t[0][0], T_SIZE, T_SIZE), k,
+                                 threshold);
+}
+
+// 同一目标图上匹配 n 个模板，目标图的频谱只计算一次，各模板在线程池中并行搜索
+std::vector<std::pair<float, MatchResult>> Match_also_scale_batch(uint8 s[S_SIZE][S_SIZE], uint8 t[][T_SIZE][T_SIZE],
+                                                                  int n) {
+    Image vs = Image::view(&s[0][0], S_SIZE, S_SIZE);
+    PreparedTarget target(vs);
+    std::vector<std::pair<float, MatchResult>> results(n);
+    ThreadPool::global().parallelFor(n, [&](int k) {
+        Image vt = Image::view(&t[k][0][0], T_SIZE, T_SIZE);
+        auto bank = ScaleBank::cached(vt, target.fftPlan(), ScaleRange::of(target, vt));
+        results[k] = searchScale(vs, target, vt, bank.get());
+    });
+    for (int k = 0; k < n; k++) {
+        fprintf(stderr, "Template=%d, Score=%f, Scale=%f, X=%d, Y=%d\n", k, results[k].second.score, results[k].first,
+                results[k].second.x, results[k].second.y);
+    }
+    return results;
+}
+
+#endif
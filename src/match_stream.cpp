@@ -0,0 +1,52 @@
+#ifndef _MATCH_STREAM_CPP
+#define _MATCH_STREAM_CPP
+
+#include <memory>
+#include <utility>
+
+#include "constants.h"
+#include "fast_match.cpp"
+#include "match_orient.cpp"
+#include "match_scale.cpp"
+
+enum class SearchMode { Plain, Orient, Scale };
+
+// One template tracked through a sequence of target frames. The template-side spectra, including the rotated
+// and scaled variants of the coarse sweeps, are computed for the first frame's FFT size and reused while the
+// frame size stays the same.
+class StreamMatcher {
+  public:
+    StreamMatcher(const Image &vt, SearchMode mode) : vt(vt.clone()), mode(mode) {}
+
+    // 返回（角度或放缩比，匹配结果），普通模式下第一项为 0
+    std::pair<float, MatchResult> match(const Image &frame) {
+        PreparedTarget target(frame);
+        switch (mode) {
+        case SearchMode::Plain:
+            if (!plain || !plain->fits(target)) {
+                plain = std::make_unique<PreparedTemplate>(target, vt);
+            }
+            return {0, fastMatch(target, *plain)};
+        case SearchMode::Orient:
+            if (!rotations || !rotations->fits(target)) {
+                rotations = std::make_unique<RotationBank>(vt, target.fftPlan());
+            }
+            return searchOrient(frame, target, vt, rotations.get());
+        case SearchMode::Scale:
+        default:
+            if (!scales || !scales->fits(target)) {
+                scales = std::make_unique<ScaleBank>(vt, target.fftPlan(), ScaleRange::of(target, vt));
+            }
+            return searchScale(frame, target, vt, scales.get());
+        }
+    }
+
+  private:
+    Image vt;
+    SearchMode mode;
+    std::unique_ptr<PreparedTemplate> plain;
+    std::unique_ptr<RotationBank> rotations;
+    std::unique_ptr<ScaleBank> scales;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _PEAK_HEAP_HPP
+#define _PEAK_HEAP_HPP
+
+#include <algorithm>
+#include <vector>
+
+// The k best peaks pushed so far, with non-maximum suppression: a peak is dropped if an overlapping peak scores
+// at least as high, and removes the overlapping peaks it beats. Among equal scores the one pushed first wins, so
+// pushing in raster order keeps fastMatch's tie rule. Peaks are kept in a min-heap of at most POOL_FACTOR * k
+// mutually non-overlapping entries, of which the best k are returned; a peak that loses to the heap's minimum is
+// rejected in constant time. The spare entries stand in when a later peak suppresses several kept ones.
+//
+// Suppression is decided as peaks arrive, so a peak can still be lost where sorting every peak and then
+// suppressing would keep it: when it was dropped by a peak that a later one removes without overlapping it, or
+// when it was rejected by a full heap that later shrinks. mayHaveLost() reports whether either happened, so a
+// caller that needs k results can scan again for peaks clear of the ones returned.
+template <typename T, typename Score, typename Overlap> class PeakHeap {
+  public:
+    // 堆的容量为 k 的倍数
+    static const int POOL_FACTOR = 4;
+
+    PeakHeap(int capacity, Score score, Overlap overlap)
+        : capacity(std::max(capacity, 0)), poolCapacity(POOL_FACTOR * this->capacity), score(score),
+          overlap(overlap) {}
+
+    // Whether a peak with this score could enter the heap. A refusal counts as a possible loss.
+    bool accepts(double value) {
+        if (capacity > 0 && (static_cast<int>(entries.size()) < poolCapacity || value > score(entries.front().peak))) {
+            return true;
+        }
+        lost = true;
+        return false;
+    }
+
+    void push(const T &peak) {
+        Entry entry{peak, sequence++, false};
+        for (Entry &other : entries) {
+            if (overlap(other.peak, peak) && !better(entry, other)) {
+                other.suppressor = true;
+                return;
+            }
+        }
+        // 去掉被新峰抑制的峰；被去掉的峰若曾抑制过其他峰，那些峰可能不再被任何保留的峰覆盖
+        auto end = std::remove_if(entries.begin(), entries.end(), [&](const Entry &other) {
+            if (!overlap(other.peak, peak)) {
+                return false;
+            }
+            lost = lost || other.suppressor;
+            entry.suppressor = true;
+            return true;
+        });
+        if (end != entries.end()) {
+            entries.erase(end, entries.end());
+            std::make_heap(entries.begin(), entries.end(), worseFirst());
+        }
+        if (static_cast<int>(entries.size()) == poolCapacity) {
+            lost = true;
+            if (!better(entry, entries.front())) {
+                return;
+            }
+            std::pop_heap(entries.begin(), entries.end(), worseFirst());
+            entries.pop_back();
+        }
+        entries.push_back(entry);
+        std::push_heap(entries.begin(), entries.end(), worseFirst());
+    }
+
+    // Best k kept peaks, best first
+    std::vector<T> sorted() const {
+        std::vector<Entry> ordered = entries;
+        std::sort(ordered.begin(), ordered.end(), [this](const Entry &a, const Entry &b) { return better(a, b); });
+        ordered.resize(std::min<int>(ordered.size(), capacity));
+        std::vector<T> result;
+        result.reserve(ordered.size());
+        for (const Entry &entry : ordered) {
+            result.push_back(entry.peak);
+        }
+        return result;
+    }
+
+    // Whether a pushed or refused peak may have been lost, see above
+    bool mayHaveLost() const { return lost; }
+
+  private:
+    struct Entry {
+        T peak;
+        // 加入的顺序，得分相同时先加入的优先
+        long long sequence;
+        // 是否抑制过其他峰
+        bool suppressor;
+    };
+
+    int capacity, poolCapacity;
+    Score score;
+    Overlap overlap;
+    long long sequence = 0;
+    bool lost = false;
+    std::vector<Entry> entries;
+
+    bool better(const Entry &a, const Entry &b) const {
+        double sa = score(a.peak), sb = score(b.peak);
+        return sa > sb || (sa == sb && a.sequence < b.sequence);
+    }
+
+    // 堆顶为最差的峰
+    auto worseFirst() const {
+        return [this](const Entry &a, const Entry &b) { return better(a, b); };
+    }
+};
+
+template <typename T, typename Score, typename Overlap>
+PeakHeap<T, Score, Overlap> makePeakHeap(int capacity, Score score, Overlap overlap) {
+    return PeakHeap<T, Score, Overlap>(capacity, score, overlap);
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef _PROFILE_HPP
+#define _PROFILE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_RDTSC
+#endif
+
+#include "constants.h"
+
+// Hot-path instrumentation. With MATCH_PROFILE defined (build.sh -p) every PROFILE_SCOPE adds one call and the
+// ticks spent in its scope to a per-thread counter; otherwise the macros expand to nothing and the hot paths are
+// unchanged. Scopes nest, so the time of a probe includes that of the probes it encloses.
+namespace Profile {
+
+enum class Probe {
+    // Fft2D::forwardReal 与 inverseReal
+    FftForward,
+    FftInverse,
+    // 目标图（及其积分图）与模板（含掩码）写入FFT输入数组
+    TargetPack,
+    TemplatePack,
+    // 模板的旋转、放缩重采样与金字塔降采样
+    Rotate,
+    Scale,
+    Downsample,
+    // scanScores 整体，以及其中每行交给调用者选取峰值的部分
+    ScoreScan,
+    PeakSelect,
+    // 角度、放缩比细化（refinePeak）中的一次试探
+    RefineProbe,
+    Count
+};
+
+const int PROBE_NUM = static_cast<int>(Probe::Count);
+
+inline const char *probeName(Probe probe) {
+    static const char *const NAMES[PROBE_NUM] = {"fft-forward", "fft-inverse", "target-pack", "template-pack",
+                                                 "rotate",      "scale",       "downsample",  "score-scan",
+                                                 "peak-select", "refine-probe"};
+    return NAMES[static_cast<int>(probe)];
+}
+
+constexpr bool enabled() {
+#ifdef MATCH_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+// 时间戳计数器，x86 上为 RDTSC，其他平台为纳秒
+inline uint64 ticks() {
+#ifdef PROFILE_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// Calls and ticks of every probe, summed over threads
+struct Totals {
+    uint64 calls[PROBE_NUM] = {};
+    uint64 ticks[PROBE_NUM] = {};
+
+    Totals operator-(const Totals &other) const {
+        Totals diff;
+        for (int i = 0; i < PROBE_NUM; i++) {
+            diff.calls[i] = calls[i] - other.calls[i];
+            diff.ticks[i] = ticks[i] - other.ticks[i];
+        }
+        return diff;
+    }
+};
+
+// Counters of one thread. Only the owning thread writes them, so an increment is a relaxed load and store rather
+// than a locked read-modify-write; snapshot() may read them from another thread at any time.
+struct ThreadCounters {
+    std::atomic<uint64> calls[PROBE_NUM] = {};
+    std::atomic<uint64> ticks[PROBE_NUM] = {};
+
+    void add(Probe probe, uint64 elapsed) {
+        const int i = static_cast<int>(probe);
+        calls[i].store(calls[i].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ticks[i].store(ticks[i].load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    }
+};
+
+// Counters of the live threads, plus the sums left by threads that have exited
+class Registry {
+  public:
+    // 不析构：线程池的线程在静态对象析构期间才退出，仍会访问它
+    static Registry &global() {
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    void attach(ThreadCounters *counters) {
+        std::lock_guard<std::mutex> guard(lock);
+        live.push_back(counters);
+    }
+
+    void detach(ThreadCounters *counters) {
+        std::lock_guard<std::mutex> guard(lock);
+        accumulate(*counters, retired);
+        live.erase(std::find(live.begin(), live.end(), counters));
+    }
+
+    Totals snapshot() {
+        std::lock_guard<std::mutex> guard(lock);
+        Totals totals = retired;
+        for (const ThreadCounters *counters : live) {
+            accumulate(*counters, totals);
+        }
+        return totals;
+    }
+
+    // Ticks per millisecond, measured against the steady clock since the registry was created
+    double ticksPerMs() {
+        using Clock = std::chrono::steady_clock;
+        // 至少经过 20ms 再测量，使频率的误差可以忽略
+        std::this_thread::sleep_until(originTime + std::chrono::milliseconds(20));
+        double elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - originTime).count();
+        return (ticks() - originTicks) / elapsedMs;
+    }
+
+  private:
+    std::mutex lock;
+    std::vector<const ThreadCounters *> live;
+    Totals retired;
+    std::chrono::steady_clock::time_point originTime = std::chrono::steady_clock::now();
+    uint64 originTicks = Profile::ticks();
+
+    static void accumulate(const ThreadCounters &counters, Totals &totals) {
+        for (int i = 0; i < PROBE_NUM; i++) {
+            totals.calls[i] += counters.calls[i].load(std::memory_order_relaxed);
+            totals.ticks[i] += counters.ticks[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// 当前线程的计数器，第一次使用时登记，线程退出时并入 retired
+inline ThreadCounters &threadCounters() {
+    struct Slot {
+        ThreadCounters counters;
+        Slot() { Registry::global().attach(&counters); }
+        ~Slot() { Registry::global().detach(&counters); }
+    };
+    thread_local Slot slot;
+    return slot.counters;
+}
+
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(Probe probe) : probe(probe), start(ticks()) {}
+    ~ScopedTimer() { threadCounters().add(probe, ticks() - start); }
+
+  private:
+    Probe probe;
+    uint64 start;
+};
+
+// Totals so far; all zero when profiling is compiled out
+inline Totals snapshot() {
+    if constexpr (enabled()) {
+        return Registry::global().snapshot();
+    }
+    return {};
+}
+
+// Prints the calls and time of every probe that ran between two snapshots, e.g. around one search. Times are summed
+// over threads, so with several workers they can exceed the wall time.
+inline void report(FILE *out, const Totals &totals) {
+    if constexpr (!enabled()) {
+        fprintf(out, "Profiling is compiled out; rebuild with ./build.sh -p\n");
+        return;
+    }
+    const double ticksPerMs = Registry::global().ticksPerMs();
+    fprintf(out, "%-14s %10s %12s %12s\n", "probe", "calls", "total_ms", "avg_us");
+    for (int i = 0; i < PROBE_NUM; i++) {
+        if (totals.calls[i] == 0) {
+            continue;
+        }
+        double totalMs = totals.ticks[i] / ticksPerMs;
+        fprintf(out, "%-14s %10llu %12.3f %12.2f\n", probeName(static_cast<Probe>(i)), totals.calls[i], totalMs,
+                totalMs * 1000 / totals.calls[i]);
+    }
+}
+
+} // namespace Profile
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef MATCH_PROFILE
+#define PROFILE_SCOPE(probe) Profile::ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(Profile::Probe::probe)
+#else
+#define PROFILE_SCOPE(probe) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _REFINE_HPP
+#define _REFINE_HPP
+
+#include <atomic>
+#include <cmath>
+
+#include "constants.h"
+#include "profile.hpp"
+
+// Stopping rules of refinePeak
+struct RefineOptions {
+    // 区间宽度小于 tolerance 时停止，单位与自变量相同
+    float tolerance = 0;
+    // 是否尝试最近三个采样点的抛物线顶点（Brent 方法），否则只做黄金分割
+    bool parabolic = true;
+    // 试探次数上限，与原先固定 10 轮黄金分割的试探次数相同
+    int maxProbes = 12;
+};
+
+template <typename Result> struct RefinedPeak {
+    float x;
+    Result result;
+    int probes;
+};
+
+// Number of probes made by refinePeak so far over all threads
+inline std::atomic<int64> &refineProbeCount() {
+    static std::atomic<int64> count{0};
+    return count;
+}
+
+// Brent's method for the highest f(x).score in [a, b], where f returns a result with a `score` member. Each step
+// tries the vertex of the parabola through the three best points so far and falls back to a golden-section step
+// when that vertex is not well inside the bracket. The search stops once the bracket is narrower than
+// options.tolerance or options.maxProbes probes have been made. There is no early exit on a flat score: the score
+// of a resampled template is piecewise constant in x, so a run of equal scores does not mean the peak is reached.
+// Returns the best point seen. Scores of -inf (a template that does not fit) never take part in a parabola fit.
+template <typename Result, typename F>
+RefinedPeak<Result> refinePeak(float a, float b, F f, const RefineOptions &options) {
+    const float CGOLD = (3 - std::sqrt(5.0)) / 2;
+    // 最小步长；|x - m| <= 2 * tol1 - (b - a) / 2 保证停止时区间宽度不超过 tolerance
+    const float tol1 = options.tolerance / 4, tol2 = 2 * tol1;
+    int probes = 0;
+    auto probe = [&](float x) {
+        PROFILE_SCOPE(RefineProbe);
+        probes++;
+        refineProbeCount().fetch_add(1, std::memory_order_relaxed);
+        return f(x);
+    };
+    // x 为目前最好的点，w 为第二好的点，v 为 w 之前的值
+    float x = a + CGOLD * (b - a);
+    Result best = probe(x);
+    float w = x, v = x;
+    double fx = best.score, fw = fx, fv = fx;
+    // d 为上一步的步长，e 为上上步的步长
+    float d = 0, e = 0;
+    while (probes < options.maxProbes) {
+        const float m = (a + b) / 2;
+        if (std::abs(x - m) <= tol2 - (b - a) / 2) {
+            break;
+        }
+        bool golden = true;
+        if (options.parabolic && std::abs(e) > tol1 && std::isfinite(fx) && std::isfinite(fw) && std::isfinite(fv)) {
+            // 求最大值：对 -score 拟合抛物线
+            double r = (x - w) * (fv - fx);
+            double q = (x - v) * (fw - fx);
+            double p = (x - v) * q - (x - w) * r;
+            q = 2 * (q - r);
+            if (q > 0) {
+                p = -p;
+            }
+            q = std::abs(q);
+            const float previous = e;
+            e = d;
+            if (std::abs(p) < std::abs(0.5 * q * previous) && p > q * (a - x) && p < q * (b - x)) {
+                d = p / q;
+                golden = false;
+                if (x + d - a < tol2 || b - (x + d) < tol2) {
+                    d = m > x ? tol1 : -tol1;
+                }
+            }
+        }
+        if (golden) {
+            e = x >= m ? a - x : b - x;
+            d = CGOLD * e;
+        }
+        const float u = std::abs(d) >= tol1 ? x + d : x + (d > 0 ? tol1 : -tol1);
+        Result current = probe(u);
+        const double fu = current.score;
+        if (fu > fx) {
+            (u >= x ? a : b) = x;
+            v = w;
+            fv = fw;
+            w = x;
+            fw = fx;
+            x = u;
+            fx = fu;
+            best = current;
+        } else {
+            (u < x ? a : b) = u;
+            if (fu >= fw || w == x) {
+                v = w;
+                fv = fw;
+                w = u;
+                fw = fu;
+            } else if (fu >= fv || v == x || v == w) {
+                v = u;
+                fv = fu;
+            }
+        }
+    }
+    return {x, best, probes};
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _SCORE_HPP
+#define _SCORE_HPP
+
+#include <atomic>
+#include <string>
+
+#include "constants.h"
+
+// How fastMatch scores a placement. Every mode is normalized so that higher is better and a perfect match scores 1:
+//   SSD   1 - sum((s - t)^2) / (n * 255^2)
+//   CC    sum(s * t) / (n * 255^2)
+//   NCC   sum(s * t) / sqrt(sum(s^2) * sum(t^2))
+//   ZNCC  NCC of the mean-subtracted window and template, in [-1, 1]; 0 where either is flat
+// where the sums run over the n pixels of the template mask.
+enum class ScoreMode { SSD, CC, NCC, ZNCC };
+
+// 各评分方式默认的匹配阈值。SSD 的阈值与 Match 的 SCORE_THRESHOLD 相同，CC 不随亮度归一化，没有有意义的阈值
+inline double defaultThreshold(ScoreMode mode) {
+    switch (mode) {
+    case ScoreMode::SSD:
+        return 1 - (256.0 * 256 / 3) / 16 * DETECT_SENSITIVITY / (255.0 * 255);
+    case ScoreMode::CC:
+        return 0;
+    case ScoreMode::NCC:
+        return 0.9;
+    case ScoreMode::ZNCC:
+        return 0.8;
+    }
+    return 0;
+}
+
+inline const char *scoreModeName(ScoreMode mode) {
+    switch (mode) {
+    case ScoreMode::SSD:
+        return "ssd";
+    case ScoreMode::CC:
+        return "cc";
+    case ScoreMode::NCC:
+        return "ncc";
+    case ScoreMode::ZNCC:
+        return "zncc";
+    }
+    return "";
+}
+
+// 按名称解析评分方式，名称无效时返回 false
+inline bool parseScoreMode(const std::string &name, ScoreMode &mode) {
+    for (ScoreMode candidate : {ScoreMode::SSD, ScoreMode::CC, ScoreMode::NCC, ScoreMode::ZNCC}) {
+        if (name == scoreModeName(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace ScoreSettings {
+
+inline std::atomic<ScoreMode> &globalMode() {
+    static std::atomic<ScoreMode> mode{ScoreMode::NCC};
+    return mode;
+}
+
+} // namespace ScoreSettings
+
+// Mode used by every matcher that is not given one explicitly. Set it before matching starts.
+inline ScoreMode globalScoreMode() { return ScoreSettings::globalMode().load(std::memory_order_relaxed); }
+
+inline void setGlobalScoreMode(ScoreMode mode) { ScoreSettings::globalMode().store(mode, std::memory_order_relaxed); }
+
+// 当前全局评分方式的默认阈值
+inline double scoreThreshold() { return defaultThreshold(globalScoreMode()); }
+
+#endif
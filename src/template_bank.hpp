@@ -0,0 +1,102 @@
+#ifndef _TEMPLATE_BANK_HPP
+#define _TEMPLATE_BANK_HPP
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "fast_match.cpp"
+#include "image.hpp"
+
+// Prepared templates of one template transformed by a single float parameter (an angle or a scale factor),
+// kept in an LRU cache keyed by the parameter and the FFT size. Safe to use from several threads.
+class RefinementCache {
+  public:
+    struct Entry {
+        float param;
+        int fftHeight, fftWidth;
+        PreparedTemplate prepared;
+        // 结果坐标需要加上的偏移（例如旋转模板的左上角位置）
+        int offsetX, offsetY;
+    };
+
+    explicit RefinementCache(size_t capacity) : capacity(capacity) {}
+
+    // Entry for param at the plan's FFT size; make(param) builds a missing one outside the lock
+    template <typename F> std::shared_ptr<const Entry> get(float param, const Utils::Fft2D &plan, F make) const {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if ((*it)->param == param && (*it)->fftHeight == plan.height && (*it)->fftWidth == plan.width) {
+                    entries.splice(entries.begin(), entries, it);
+                    return entries.front();
+                }
+            }
+        }
+        std::shared_ptr<const Entry> entry = make(param);
+        std::lock_guard<std::mutex> guard(lock);
+        entries.push_front(entry);
+        if (entries.size() > capacity) {
+            entries.pop_back();
+        }
+        return entry;
+    }
+
+  private:
+    size_t capacity;
+    mutable std::mutex lock;
+    // 最近使用的排在最前
+    mutable std::list<std::shared_ptr<const Entry>> entries;
+};
+
+inline bool sameImage(const Image &a, const Image &b) {
+    if (a.height != b.height || a.width != b.width) {
+        return false;
+    }
+    for (int i = 0; i < a.height; i++) {
+        if (!std::equal(a.row(i), a.row(i) + a.width, b.row(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bank of type Bank for vt at the plan's FFT size, shared by every search with the same template pixels. The few
+// most recently used banks of each type are kept; a different template evicts the oldest. Bank must provide
+// templateImage() and fftSize() and be constructible from (vt, plan, params...). Extra params are part of the key,
+// and Bank must then also provide params() returning a tuple comparable with std::tie(params...).
+template <typename Bank, typename... Params>
+std::shared_ptr<const Bank> cachedBank(const Image &vt, const Utils::Fft2D &plan, const Params &...params) {
+    const size_t BANK_CACHE_SIZE = 4;
+    static std::mutex lock;
+    static std::list<std::shared_ptr<const Bank>> banks;
+    auto sameParams = [&](const Bank &bank) {
+        if constexpr (sizeof...(Params) > 0) {
+            return bank.params() == std::tie(params...);
+        } else {
+            return true;
+        }
+    };
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = banks.begin(); it != banks.end(); ++it) {
+            if ((*it)->fftSize() == std::make_pair(plan.height, plan.width) && sameParams(**it) &&
+                sameImage((*it)->templateImage(), vt)) {
+                banks.splice(banks.begin(), banks, it);
+                return banks.front();
+            }
+        }
+    }
+    // 在锁外构建，避免阻塞其他模板的查找
+    auto bank = std::make_shared<const Bank>(vt, plan, params...);
+    std::lock_guard<std::mutex> guard(lock);
+    banks.push_front(bank);
+    if (banks.size() > BANK_CACHE_SIZE) {
+        banks.pop_back();
+    }
+    return bank;
+}
+
+#endif
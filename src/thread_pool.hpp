@@ -0,0 +1,166 @@
+#ifndef _THREAD_POOL_HPP
+#define _THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "constants.h"
+
+// Work-stealing pool. Each background thread owns a deque: it pops its own tasks from the back and steals
+// from the front of the others. The thread calling parallelFor runs tasks too while it waits, so nested
+// parallelFor calls from inside a task cannot deadlock.
+class ThreadPool {
+  public:
+    // workerNum counts the calling thread, so a pool of 1 runs everything inline
+    explicit ThreadPool(int workerNum) : queues(std::max(workerNum - 1, 0)) {
+        for (int i = 0; i < (int)queues.size(); i++) {
+            queues[i] = std::make_unique<WorkQueue>();
+        }
+        for (int i = 0; i < (int)queues.size(); i++) {
+            threads.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    int workerNum() const { return threads.size() + 1; }
+
+    // Run fn(i) for every i in [0, n) and wait for all of them. Results must be written to per-index slots
+    // by the caller, so the outcome does not depend on the order tasks finish in.
+    template <typename F> void parallelFor(int n, F fn) {
+        if (threads.empty() || n <= 1) {
+            for (int i = 0; i < n; i++) {
+                fn(i);
+            }
+            return;
+        }
+        std::atomic<int> remaining(n);
+        std::exception_ptr error;
+        std::mutex errorLock;
+        for (int i = 0; i < n; i++) {
+            push(i % queues.size(), [&, i] {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(errorLock);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                remaining--;
+            });
+        }
+        {
+            // 在锁内同步一次，避免与正要休眠的线程错过通知
+            std::lock_guard<std::mutex> guard(sleepLock);
+        }
+        wakeup.notify_all();
+        while (remaining > 0) {
+            if (!runOne(0)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    static void setGlobalWorkerNum(int workerNum) { globalWorkerNum() = workerNum; }
+
+    // Shared pool sized by setGlobalWorkerNum (or DEFAULT_WORKER_NUM) at its first use
+    static ThreadPool &global() {
+        static ThreadPool pool([] {
+            int n = globalWorkerNum();
+            if (n <= 0) {
+                n = std::max<int>(std::thread::hardware_concurrency(), 1);
+            }
+            return n;
+        }());
+        return pool;
+    }
+
+  private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending{0};
+    std::mutex sleepLock;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    static int &globalWorkerNum() {
+        static int n = DEFAULT_WORKER_NUM;
+        return n;
+    }
+
+    void push(int id, std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> guard(queues[id]->lock);
+            queues[id]->tasks.push_back(std::move(task));
+        }
+        pending++;
+    }
+
+    // Take a task from queue `home` (back) or steal one from another queue (front)
+    bool runOne(int home) {
+        std::function<void()> task;
+        const int n = queues.size();
+        for (int k = 0; k < n && !task; k++) {
+            WorkQueue &queue = *queues[(home + k) % n];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        pending--;
+        task();
+        return true;
+    }
+
+    void workerLoop(int id) {
+        while (true) {
+            if (runOne(id)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wakeup.wait(guard, [this] { return stopping || pending > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _TILED_MATCH_CPP
+#define _TILED_MATCH_CPP
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "constants.h"
+#include "fast_match.cpp"
+#include "thread_pool.hpp"
+
+// 分块相关的FFT边长下限。256x256 的块各数组合计约 2MB，与常见的 L2 缓存相当
+const int DEFAULT_TILE_FFT_SIZE = 256;
+
+// Overlap-save tiling of a target for one template. The score surface is cut into blocks of validHeight x
+// validWidth positions; the target tile behind a block is that block plus the template size minus one, and every
+// tile is correlated at the same fftHeight x fftWidth, so one template spectrum serves all of them. Tiles at the
+// bottom and right edges are simply smaller and zero-padded.
+struct TileGrid {
+    int fftHeight, fftWidth;
+    int validHeight, validWidth;
+    int rows, cols;
+
+    // The FFT side is planned from the larger of tileSize and twice the template side, so at least half of every
+    // tile is valid
+    TileGrid(int sHeight, int sWidth, int tHeight, int tWidth, int tileSize = DEFAULT_TILE_FFT_SIZE) {
+        fftHeight = Utils::nextFastSize(std::max(tileSize, 2 * tHeight));
+        fftWidth = Utils::nextFastEvenSize(std::max(tileSize, 2 * tWidth));
+        validHeight = fftHeight - tHeight + 1;
+        validWidth = fftWidth - tWidth + 1;
+        int resHeight = std::max(sHeight - tHeight + 1, 0);
+        int resWidth = std::max(sWidth - tWidth + 1, 0);
+        rows = (resHeight + validHeight - 1) / validHeight;
+        cols = (resWidth + validWidth - 1) / validWidth;
+    }
+};
+
+// fastMatch for targets of any size, with peak memory bounded by the tile size instead of the target size. Each
+// tile gets its own PreparedTarget (spectrum and integral images of the tile only) and is scanned on the thread
+// pool; the per-tile maxima are reduced with raster-order ties. Correlations are rounded to integers before
+// scoring, so the result equals fastMatch on the whole target.
+MatchResult tiledMatch(const Image &s, const Image &t, ScoreMode mode = globalScoreMode(),
+                       int tileSize = DEFAULT_TILE_FFT_SIZE) {
+    if (t.height > s.height || t.width > s.width) {
+        return {-std::numeric_limits<double>::infinity(), -1, -1};
+    }
+    const TileGrid grid(s.height, s.width, t.height, t.width, tileSize);
+    const PreparedTemplate prepared(*Utils::Fft2D::cached(grid.fftHeight, grid.fftWidth), t);
+    std::vector<MatchResult> tileResults(grid.rows * grid.cols);
+    ThreadPool::global().parallelFor(grid.rows * grid.cols, [&](int id) {
+        int x = id / grid.cols * grid.validHeight, y = id % grid.cols * grid.validWidth;
+        int h = std::min(grid.fftHeight, s.height - x), w = std::min(grid.fftWidth, s.width - y);
+        PreparedTarget tile(s.crop(x, y, h, w), grid.fftHeight, grid.fftWidth);
+        MatchResult best = fastMatch(tile, prepared, mode);
+        tileResults[id] = {best.score, best.x + x, best.y + y};
+    });
+    MatchResult best = {-std::numeric_limits<double>::infinity(), -1, -1};
+    for (const MatchResult &result : tileResults) {
+        // 块按行优先排列，但右侧块中位置的行号可能更小，需按光栅序比较并列
+        bool earlier = result.x < best.x || (result.x == best.x && result.y < best.y);
+        if (result.score > best.score || (result.score == best.score && earlier)) {
+            best = result;
+        }
+    }
+    return best;
+}
+
+#endif
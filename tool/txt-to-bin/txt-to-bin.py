@@ -0,0 +1,25 @@
+import struct
+import sys
+
+def txt_to_binary(input_path, output_path):
+    # 读取文本格式的灰度图
+    with open(input_path) as f:
+        values = list(map(int, f.read().split()))
+    height, width = values[0], values[1]
+    pixels = values[2:2 + height * width]
+    if len(pixels) != height * width:
+        raise ValueError(f"{input_path}: expected {height * width} pixels, got {len(pixels)}")
+
+    # 写入二进制文件：魔数、小端序的高和宽、逐行存放的像素
+    with open(output_path, 'wb') as f:
+        f.write(b"TMG1")
+        f.write(struct.pack("<II", height, width))
+        f.write(bytes(pixels))
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python script.py <input_txt_path> <output_bin_path>")
+    else:
+        input_txt_path = sys.argv[1]
+        output_bin_path = sys.argv[2]
+        txt_to_binary(input_txt_path, output_bin_path)